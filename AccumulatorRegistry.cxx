@@ -0,0 +1,39 @@
+#include "AccumulatorRegistry.h"
+
+
+AccumulatorRegistry::AccumulatorRegistry(const std::vector<std::string>& branchNames) : branches(branchNames) {
+  accumulators[kInput].assign(branches.size(), (BranchAccumulator*)0);
+  accumulators[kReference].assign(branches.size(), (BranchAccumulator*)0);
+}
+
+
+AccumulatorRegistry::~AccumulatorRegistry() {
+  for (size_t i=0; i<branches.size(); ++i) {
+    delete accumulators[kInput][i];
+    delete accumulators[kReference][i];
+  }
+}
+
+
+BranchAccumulator* AccumulatorRegistry::Create(Role role, size_t branch, int nbins, double lowLimit, double highLimit) {
+  Adopt(role, branch, new BranchAccumulator(HistogramName(role, branches[branch]), nbins, lowLimit, highLimit));
+  return accumulators[role][branch];
+}
+
+
+BranchAccumulator* AccumulatorRegistry::CreateMatching(Role role, size_t branch, const BranchAccumulator& binningFrom) {
+  Adopt(role, branch, new BranchAccumulator(HistogramName(role, branches[branch]), binningFrom));
+  return accumulators[role][branch];
+}
+
+
+void AccumulatorRegistry::Adopt(Role role, size_t branch, BranchAccumulator *accumulator) {
+  if (accumulators[role][branch] == accumulator) return;
+  delete accumulators[role][branch];
+  accumulators[role][branch] = accumulator;
+}
+
+
+std::string AccumulatorRegistry::HistogramName(Role role, const std::string& branchName) {
+  return (role == kReference ? "ref_" : "plt_") + branchName;
+}
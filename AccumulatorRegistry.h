@@ -0,0 +1,44 @@
+#ifndef ACCUMULATORREGISTRY_H
+#define ACCUMULATORREGISTRY_H
+
+// Standard Library
+#include <string>
+#include <vector>
+
+#include "BranchAccumulator.h"
+
+
+// Input and reference accumulators of one comparison (a pass over a pair of
+// trees), owned here and indexed by role and branch rather than found by
+// histogram name. Their histograms are detached from any directory, so
+// comparisons running in other threads never share a name or a directory list.
+class AccumulatorRegistry {
+public:
+  enum Role { kInput = 0, kReference = 1 };
+
+  explicit AccumulatorRegistry(const std::vector<std::string>& branchNames);
+  ~AccumulatorRegistry(); // deletes all accumulators
+
+  // Accumulators in branch order, null where none was created; the vectors
+  // keep their size, so references to them stay valid
+  const std::vector<BranchAccumulator*>& Get(Role role) const { return accumulators[role]; }
+  BranchAccumulator* Get(Role role, size_t branch) const { return accumulators[role][branch]; }
+
+  BranchAccumulator* Create(Role role, size_t branch, int nbins, double lowLimit, double highLimit);
+  BranchAccumulator* CreateMatching(Role role, size_t branch, const BranchAccumulator& binningFrom);
+
+  // Takes ownership, e.g. of an accumulator restored from a checkpoint; may be null
+  void Adopt(Role role, size_t branch, BranchAccumulator *accumulator);
+
+  // Histogram name of a branch, for output only
+  static std::string HistogramName(Role role, const std::string& branchName);
+
+private:
+  AccumulatorRegistry(const AccumulatorRegistry&);
+  AccumulatorRegistry& operator=(const AccumulatorRegistry&);
+
+  std::vector<std::string> branches;
+  std::vector<BranchAccumulator*> accumulators[2];
+};
+
+#endif
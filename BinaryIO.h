@@ -0,0 +1,53 @@
+#ifndef BINARYIO_H
+#define BINARYIO_H
+
+// Standard Library
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Raw binary reads and writes of plain values, strings and vectors, for
+// state that is only read back by the same build (checkpoints, partials).
+// Reads return false on a short or corrupt stream.
+
+template <typename T>
+inline void WriteBinary(std::ostream& out, const T& value) {
+  out.write((const char*) &value, sizeof(T));
+}
+
+template <typename T>
+inline bool ReadBinary(std::istream& in, T& value) {
+  return (bool) in.read((char*) &value, sizeof(T));
+}
+
+inline void WriteBinary(std::ostream& out, const std::string& value) {
+  unsigned long long size = value.size();
+  WriteBinary(out, size);
+  out.write(value.data(), size);
+}
+
+inline bool ReadBinary(std::istream& in, std::string& value) {
+  unsigned long long size = 0;
+  if (!ReadBinary(in, size) || size > (1ULL << 24)) return false;
+  value.resize(size);
+  return size == 0 || (bool) in.read(&value[0], size);
+}
+
+template <typename T>
+inline void WriteBinary(std::ostream& out, const std::vector<T>& values) {
+  unsigned long long size = values.size();
+  WriteBinary(out, size);
+  if (size > 0) out.write((const char*) &values[0], size*sizeof(T));
+}
+
+template <typename T>
+inline bool ReadBinary(std::istream& in, std::vector<T>& values) {
+  unsigned long long size = 0;
+  if (!ReadBinary(in, size) || size > (1ULL << 32)/sizeof(T)) return false;
+  values.resize(size);
+  return size == 0 || (bool) in.read((char*) &values[0], size*sizeof(T));
+}
+
+#endif
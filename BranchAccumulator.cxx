@@ -0,0 +1,473 @@
+// Standard Library
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "BranchAccumulator.h"
+#include "VectorKernels.h"
+#include "BinaryIO.h"
+
+// ROOT includes
+#include "TMath.h"
+#include "TList.h"
+#include "TDirectory.h"
+
+
+BranchAccumulator::BranchAccumulator(const std::string& histName, int nbins, double lowLimit, double highLimit)
+  : binningFixed(lowLimit < highLimit), directFills(false), finalised(false), entries(0), sumw(0), sumw2(0), mean(0), m2(0), m3(0),
+    minValue(std::numeric_limits<double>::max()),
+    maxValue(-std::numeric_limits<double>::max()),
+    exact(false), exactOffset(0) {
+  std::string title="";
+  TDirectory::TContext detached(0); // owned here, never listed in gDirectory
+  hist = new TH1D(histName.c_str(),title.c_str(),nbins,lowLimit,highLimit); // lowLimit>=highLimit: automatic limits
+  if ( hist->GetSumw2N() == 0 ) hist->Sumw2();
+  blockValues.reserve(kBlockSize);
+  blockWeights.reserve(kBlockSize);
+}
+
+
+BranchAccumulator::BranchAccumulator(const std::string& histName, const BranchAccumulator& binningFrom)
+  : binningFixed(binningFrom.binningFixed), directFills(false), finalised(false), entries(0), sumw(0), sumw2(0), mean(0), m2(0), m3(0),
+    minValue(std::numeric_limits<double>::max()),
+    maxValue(-std::numeric_limits<double>::max()),
+    exact(binningFrom.exact), exactOffset(0) {
+  // binningFrom is finalised or its binning fixed, so both histograms have
+  // identical binning; exact counts before Finalise are binned later alike
+  TDirectory::TContext detached(0);
+  hist = (TH1*) binningFrom.hist->Clone(histName.c_str());
+  hist->SetDirectory(0);
+  hist->Reset();
+  if ( hist->GetSumw2N() == 0 ) hist->Sumw2();
+  blockValues.reserve(kBlockSize);
+  blockWeights.reserve(kBlockSize);
+}
+
+
+BranchAccumulator::BranchAccumulator(TH1 *adopted, int axis)
+  : hist(adopted), binningFixed(true), directFills(false), finalised(false), entries(adopted->GetEntries()), sumw(0), sumw2(0), mean(0), m2(0), m3(0),
+    minValue(std::numeric_limits<double>::max()),
+    maxValue(-std::numeric_limits<double>::max()),
+    exact(false), exactOffset(0) {
+  // Histogram statistics: sumw, sumw2, then sumwx, sumwx2 per axis
+  double stats[13] = {0};
+  hist->GetStats(stats);
+  sumw = stats[0];
+  sumw2 = stats[1];
+  int offset = (axis == 2) ? 4 : 2;
+  if (sumw != 0) {
+    mean = stats[offset]/sumw;
+    m2 = stats[offset+1] - sumw*mean*mean;
+    double std = GetStdDev();
+    m3 = hist->GetSkewness(axis)*std*std*std*sumw; // only available from the bins
+  }
+}
+
+
+BranchAccumulator::~BranchAccumulator() {
+  delete hist;
+}
+
+
+void BranchAccumulator::EnableExactCounting() {
+  // Accumulators already filled, e.g. restored from a checkpoint, keep the
+  // counting they had: counts from a later entry on only would be partial
+  if (entries == 0 && blockValues.empty() && !directFills) exact = true;
+}
+
+
+void BranchAccumulator::FlushBlock() {
+  size_t n = blockValues.size();
+  if (n == 0) return;
+  const double *x = &blockValues[0];
+  const double *w = &blockWeights[0];
+
+  // Fixed regular bins are filled in place, anything else goes through TH1::Fill
+  TH1D *h1 = dynamic_cast<TH1D*>(hist);
+  const TAxis *axis = hist->GetXaxis();
+  if (!exact && binningFixed && h1 && !hist->GetBuffer() && !hist->CanExtendAllAxes() &&
+      hist->GetSumw2N() > 0 && axis->GetXbins()->GetSize() == 0) {
+    BlockHistogramKernel(x, w, n, axis->GetNbins(), axis->GetXmin(), axis->GetXmax(),
+                         h1->GetArray(), hist->GetSumw2()->GetArray());
+    directFills = true;
+  }
+  else {
+    for (size_t i=0; i<n; ++i) {
+      if (exact) FillExact(x[i], w[i]);
+      else hist->Fill(x[i], w[i]);
+    }
+    // Automatic limits are set once the histogram buffer has been emptied
+    if (!exact && !binningFixed && !hist->GetBuffer()) binningFixed = true;
+  }
+
+  // Block sums about the running mean, merged into the central moments
+  double shift = (sumw != 0) ? mean : x[0];
+  BlockMoments block = {0, 0, 0, 0, 0, minValue, maxValue};
+  BlockMomentsKernel(x, w, n, shift, block);
+  entries += n;
+  minValue = block.min;
+  maxValue = block.max;
+  if (block.sumw != 0) {
+    double blockMean = block.s1/block.sumw;
+    double blockM2 = block.s2 - block.s1*blockMean;
+    double blockM3 = block.s3 - 3.0*block.s2*blockMean + 2.0*block.s1*blockMean*blockMean;
+    MergeMoments(block.sumw, block.sumw2, shift + blockMean, blockM2, blockM3);
+  }
+  else { // zero or cancelling weights, merge point by point
+    for (size_t i=0; i<n; ++i) {
+      if (w[i] != 0) MergeMoments(w[i], w[i]*w[i], x[i], 0, 0);
+    }
+  }
+
+  blockValues.clear();
+  blockWeights.clear();
+}
+
+
+void BranchAccumulator::MergeMoments(double blockSumw, double blockSumw2, double blockMean, double blockM2, double blockM3) {
+  double sumwOld = sumw;
+  sumw += blockSumw;
+  sumw2 += blockSumw2;
+  if (sumw == 0) { // cancelling negative weights, restart the moments
+    mean = m2 = m3 = 0;
+    return;
+  }
+  double delta = blockMean - mean;
+  double deltaW = delta*blockSumw/sumw;
+  mean += deltaW;
+  m3 += blockM3 + delta*deltaW*deltaW*sumwOld*(sumwOld - blockSumw)/blockSumw
+        + 3.0*delta*(sumwOld*blockM2 - blockSumw*m2)/sumw;
+  m2 += blockM2 + delta*deltaW*sumwOld; // delta^2 * W_old * W_block / W
+}
+
+
+void BranchAccumulator::FillExact(double value, double weight) {
+  if (!AddExactCount(std::llround(value), weight, weight*weight)) hist->Fill(value, weight);
+}
+
+
+bool BranchAccumulator::AddExactCount(long long v, double countSumw, double countSumw2) {
+  if (exactSumw.empty()) {
+    exactOffset = v;
+    exactSumw.assign(1, 0);
+    exactSumw2.assign(1, 0);
+  }
+
+  // Grow the dense range on either side, up to kMaxExactValues
+  long long index = v - exactOffset;
+  long long size = exactSumw.size();
+  long long span = (index < 0) ? size - index : std::max(size, index + 1);
+  if (span > kMaxExactValues) {
+    StopExactCounting();
+    return false;
+  }
+  if (index < 0) {
+    exactSumw.insert(exactSumw.begin(), -index, 0.0);
+    exactSumw2.insert(exactSumw2.begin(), -index, 0.0);
+    exactOffset = v;
+    index = 0;
+  }
+  else if (index >= size) {
+    exactSumw.resize(index + 1, 0.0);
+    exactSumw2.resize(index + 1, 0.0);
+  }
+  exactSumw[index] += countSumw;
+  exactSumw2[index] += countSumw2;
+  return true;
+}
+
+
+void BranchAccumulator::AddBinCount(double value, double countSumw, double countSumw2) {
+  int bin = hist->FindBin(value); // extends the axis if allowed
+  double error = hist->GetBinError(bin);
+  hist->SetBinContent(bin, hist->GetBinContent(bin) + countSumw);
+  hist->SetBinError(bin, std::sqrt(error*error + countSumw2));
+  directFills = true;
+}
+
+
+void BranchAccumulator::StopExactCounting() {
+  if (!binningFixed) {
+    // Regular bins over the values seen so far, extended by later fills
+    int nbins = hist->GetNbinsX();
+    hist->SetBuffer(0);
+    hist->SetBins(nbins, exactOffset - 0.5, exactOffset + (double)exactSumw.size() - 0.5);
+    hist->SetCanExtend(TH1::kAllAxes);
+    binningFixed = true;
+  }
+  ProjectExactCounts();
+  exact = false;
+  std::vector<double>().swap(exactSumw);
+  std::vector<double>().swap(exactSumw2);
+}
+
+
+void BranchAccumulator::ProjectExactCounts() {
+  for (size_t i=0; i<exactSumw.size(); ++i) {
+    if (exactSumw2[i] == 0) continue;
+    int bin = hist->FindFixBin(exactOffset + (double)i);
+    double error = hist->GetBinError(bin);
+    hist->SetBinContent(bin, hist->GetBinContent(bin) + exactSumw[i]);
+    hist->SetBinError(bin, std::sqrt(error*error + exactSumw2[i]));
+  }
+  hist->ResetStats();
+}
+
+
+void BranchAccumulator::FixBinning() {
+  FlushBlock();
+  if (!exact && !binningFixed) {
+    hist->BufferEmpty(1);
+    binningFixed = true;
+  }
+}
+
+
+void BranchAccumulator::Finalise() {
+  if (finalised) return;
+  finalised = true;
+  FlushBlock();
+  std::vector<double>().swap(blockValues);
+  std::vector<double>().swap(blockWeights);
+
+  if (exact) {
+    if (!binningFixed) {
+      // One bin per value
+      int nbins = std::max<int>(1, exactSumw.size());
+      hist->SetBuffer(0);
+      hist->SetBins(nbins, exactOffset - 0.5, exactOffset + nbins - 0.5);
+      binningFixed = true;
+    }
+    ProjectExactCounts();
+    hist->SetEntries(entries);
+  }
+  else if (!binningFixed) {
+    hist->BufferEmpty(1);
+    binningFixed = true;
+  }
+  if (directFills) {
+    hist->ResetStats();
+    hist->SetEntries(entries);
+  }
+}
+
+
+void BranchAccumulator::Merge(const BranchAccumulator& other, std::ostream& out) {
+  // Values still staged in the other accumulator are filled as usual
+  for (size_t i=0; i<other.blockValues.size(); ++i) Fill(other.blockValues[i], other.blockWeights[i]);
+  FlushBlock();
+
+  entries += other.entries; // its staged values were counted by FlushBlock above
+  minValue = std::min(minValue, other.minValue);
+  maxValue = std::max(maxValue, other.maxValue);
+  if (other.sumw != 0) MergeMoments(other.sumw, other.sumw2, other.mean, other.m2, other.m3);
+  else sumw2 += other.sumw2;
+
+  // Exact counts stay exact while the values fit, anything else goes to the histogram
+  size_t first = 0;
+  if (exact && other.exact) {
+    while (first < other.exactSumw.size() &&
+           AddExactCount(other.exactOffset + (long long)first, other.exactSumw[first], other.exactSumw2[first])) ++first;
+    if (exact) return;
+  }
+  if (exact) StopExactCounting();
+  if (other.exact) {
+    if (!binningFixed) {
+      hist->BufferEmpty(1);
+      binningFixed = !hist->GetBuffer() && hist->GetXaxis()->GetXmin() < hist->GetXaxis()->GetXmax();
+    }
+    if (!binningFixed) { // nothing filled yet, bins around the exact values
+      hist->SetBuffer(0);
+      hist->SetBins(hist->GetNbinsX(), other.exactOffset - 0.5, other.exactOffset + (double)other.exactSumw.size() - 0.5);
+      hist->SetCanExtend(TH1::kAllAxes);
+      binningFixed = true;
+    }
+    for (size_t i=first; i<other.exactSumw.size(); ++i) {
+      if (other.exactSumw2[i] != 0) AddBinCount(other.exactOffset + (double)i, other.exactSumw[i], other.exactSumw2[i]);
+    }
+  }
+  else {
+    TList list;
+    list.Add(other.hist);
+    if (hist->Merge(&list) < 0) {
+      // Fixed bins that do not line up: the other values go in at their bin centres
+      out<<"WARNING: incompatible binning of "<<hist->GetName()<<" merged at the bin centres"<<std::endl;
+      const double *buffer = other.hist->GetBuffer();
+      int nbuffered = buffer ? (int) buffer[0] : 0;
+      for (int k=0; k<nbuffered; ++k) AddBinCount(buffer[2*k+2], buffer[2*k+1], buffer[2*k+1]*buffer[2*k+1]);
+      for (int bin=0; nbuffered==0 && bin<=other.hist->GetNbinsX()+1; ++bin) {
+        double error = other.hist->GetBinError(bin);
+        if (error != 0) AddBinCount(other.hist->GetBinCenter(bin), other.hist->GetBinContent(bin), error*error);
+      }
+    }
+    directFills = true;
+    if (!binningFixed && !hist->GetBuffer()) binningFixed = true;
+  }
+}
+
+
+namespace {
+  const int kSerialVersion = 1;
+}
+
+
+void BranchAccumulator::Serialise(std::ostream& out) const {
+  const TAxis *axis = hist->GetXaxis();
+  WriteBinary(out, kSerialVersion);
+  WriteBinary(out, std::string(hist->GetName()));
+  WriteBinary(out, axis->GetNbins());
+  WriteBinary(out, axis->GetXmin());
+  WriteBinary(out, axis->GetXmax());
+  WriteBinary(out, binningFixed);
+  WriteBinary(out, (bool) hist->CanExtendAllAxes());
+  WriteBinary(out, directFills);
+  WriteBinary(out, finalised);
+
+  // Bins once the binning is fixed, otherwise the (weight, value) pairs in the histogram buffer
+  std::vector<double> contents, errors, buffered;
+  if (binningFixed) {
+    for (int bin=0; bin<hist->GetNcells(); ++bin) {
+      contents.push_back(hist->GetBinContent(bin));
+      errors.push_back(hist->GetBinError(bin));
+    }
+  }
+  else if (hist->GetBuffer()) {
+    const double *buffer = hist->GetBuffer();
+    int nbuffered = std::abs((int) buffer[0]);
+    buffered.assign(buffer + 1, buffer + 1 + 2*nbuffered);
+  }
+  WriteBinary(out, contents);
+  WriteBinary(out, errors);
+  WriteBinary(out, buffered);
+  WriteBinary(out, blockValues);
+  WriteBinary(out, blockWeights);
+
+  double moments[8] = {entries, sumw, sumw2, mean, m2, m3, minValue, maxValue};
+  WriteBinary(out, moments);
+  WriteBinary(out, exact);
+  WriteBinary(out, exactOffset);
+  WriteBinary(out, exactSumw);
+  WriteBinary(out, exactSumw2);
+}
+
+
+BranchAccumulator* BranchAccumulator::Deserialise(std::istream& in) {
+  int version = 0;
+  std::string name;
+  int nbins = 0;
+  double xmin = 0, xmax = 0;
+  bool fixed = false, canExtend = false, direct = false, done = false;
+  if (!ReadBinary(in, version) || version != kSerialVersion || !ReadBinary(in, name) ||
+      !ReadBinary(in, nbins) || !ReadBinary(in, xmin) || !ReadBinary(in, xmax) || nbins < 1 ||
+      !ReadBinary(in, fixed) || !ReadBinary(in, canExtend) || !ReadBinary(in, direct) || !ReadBinary(in, done)) {
+    return 0;
+  }
+
+  BranchAccumulator *acc = new BranchAccumulator(name, nbins, fixed ? xmin : 0, fixed ? xmax : -9999);
+  if (canExtend) acc->hist->SetCanExtend(TH1::kAllAxes);
+  acc->directFills = direct;
+  acc->finalised = done;
+
+  std::vector<double> contents, errors, buffered;
+  double moments[8];
+  bool ok = ReadBinary(in, contents) && ReadBinary(in, errors) && ReadBinary(in, buffered) &&
+    ReadBinary(in, acc->blockValues) && ReadBinary(in, acc->blockWeights) && ReadBinary(in, moments) &&
+    ReadBinary(in, acc->exact) && ReadBinary(in, acc->exactOffset) &&
+    ReadBinary(in, acc->exactSumw) && ReadBinary(in, acc->exactSumw2);
+  ok = ok && contents.size() == errors.size() && acc->exactSumw.size() == acc->exactSumw2.size()
+    && acc->blockValues.size() == acc->blockWeights.size() && (!fixed || (int) contents.size() == acc->hist->GetNcells());
+  if (!ok) {
+    delete acc;
+    return 0;
+  }
+
+  for (size_t bin=0; bin<contents.size(); ++bin) {
+    acc->hist->SetBinContent(bin, contents[bin]);
+    acc->hist->SetBinError(bin, errors[bin]);
+  }
+  for (size_t i=0; i+1<buffered.size(); i+=2) acc->hist->Fill(buffered[i+1], buffered[i]);
+
+  acc->entries = moments[0];
+  acc->sumw = moments[1];
+  acc->sumw2 = moments[2];
+  acc->mean = moments[3];
+  acc->m2 = moments[4];
+  acc->m3 = moments[5];
+  acc->minValue = moments[6];
+  acc->maxValue = moments[7];
+  if (done) {
+    acc->hist->ResetStats();
+    acc->hist->SetEntries(acc->entries);
+  }
+  else if (fixed) acc->directFills = true; // statistics recomputed by Finalise
+  return acc;
+}
+
+
+double BranchAccumulator::GetEffectiveEntries() const {
+  return (sumw2 > 0) ? sumw*sumw/sumw2 : 0;
+}
+
+
+double BranchAccumulator::GetStdDev() const {
+  if (sumw <= 0 || m2 <= 0) return 0;
+  return std::sqrt(m2/sumw);
+}
+
+
+double BranchAccumulator::GetMeanError() const {
+  double neff = GetEffectiveEntries();
+  return (neff > 0) ? GetStdDev()/std::sqrt(neff) : 0;
+}
+
+
+double BranchAccumulator::GetStdDevError() const {
+  double neff = GetEffectiveEntries();
+  return (neff > 0) ? GetStdDev()/std::sqrt(2.0*neff) : 0;
+}
+
+
+double BranchAccumulator::GetSkewness() const {
+  double std = GetStdDev();
+  if (std <= 0) return 0;
+  return (m3/sumw)/(std*std*std);
+}
+
+
+double ExactChi2Test(const BranchAccumulator& acc, const BranchAccumulator& refacc) {
+  const std::vector<double>& a = acc.GetExactSumw();
+  const std::vector<double>& b = refacc.GetExactSumw();
+  if (!acc.HasExactCounts() || !refacc.HasExactCounts() || a.empty() || b.empty()) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+
+  // Weighted counts are scaled to effective counts
+  double scaleA = acc.GetEffectiveEntries()/acc.GetSumOfWeights();
+  double scaleB = refacc.GetEffectiveEntries()/refacc.GetSumOfWeights();
+  long long offsetA = acc.GetExactOffset();
+  long long offsetB = refacc.GetExactOffset();
+  long long first = std::min(offsetA, offsetB);
+  long long last = std::max(offsetA + (long long)a.size(), offsetB + (long long)b.size());
+
+  double na = 0, nb = 0;
+  for (size_t i=0; i<a.size(); ++i) na += a[i]*scaleA;
+  for (size_t i=0; i<b.size(); ++i) nb += b[i]*scaleB;
+  if (na <= 0 || nb <= 0) return std::numeric_limits<double>::quiet_NaN();
+
+  double ra = std::sqrt(nb/na);
+  double rb = std::sqrt(na/nb);
+  double chi2 = 0;
+  int ncategories = 0;
+  for (long long v=first; v<last; ++v) {
+    long long ia = v - offsetA;
+    long long ib = v - offsetB;
+    double ca = (ia >= 0 && ia < (long long)a.size()) ? a[ia]*scaleA : 0;
+    double cb = (ib >= 0 && ib < (long long)b.size()) ? b[ib]*scaleB : 0;
+    if (ca + cb <= 0) continue;
+    double d = ca*ra - cb*rb;
+    chi2 += d*d/(ca + cb);
+    ++ncategories;
+  }
+  if (ncategories < 2) return 1.0; // a single common value
+  return TMath::Prob(chi2, ncategories - 1);
+}
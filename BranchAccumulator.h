@@ -0,0 +1,134 @@
+#ifndef BRANCHACCUMULATOR_H
+#define BRANCHACCUMULATOR_H
+
+// Standard Library
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// ROOT includes
+#include "TH1.h"
+
+
+// Per-branch accumulator filled once per value from the event loop.
+// Holds the weighted histogram used for the KS and Chi2 tests and
+// the exact weighted moments (mean, variance, skewness) which do not
+// depend on the binning. Pre-filled histograms can be adopted as well,
+// their moments are then taken from the histogram statistics.
+// Histograms created by the accumulator are detached from any directory;
+// its name is only a label for output.
+//
+// Integer and boolean branches are counted exactly, one cell per value,
+// and only projected onto the histogram by Finalise(): the input gets one
+// bin per value, the reference the binning of the input.
+//
+// Values are staged in blocks of kBlockSize and handed to the vectorised
+// kernels of VectorKernels.h, so moments and histogram are only complete
+// after Finalise().
+class BranchAccumulator {
+public:
+  BranchAccumulator(const std::string& histName, int nbins, double lowLimit, double highLimit);
+  BranchAccumulator(const std::string& histName, const BranchAccumulator& binningFrom); // after Finalise or FixBinning
+  BranchAccumulator(TH1 *adopted, int axis); // takes ownership, moments along axis 1 (x) or 2 (y)
+  ~BranchAccumulator();
+
+  // Switch to exact counting of integer values; ignored once values were
+  // filled, so an accumulator that stopped counting exactly stays binned
+  void EnableExactCounting();
+
+  void Fill(double value, double weight) {
+    blockValues.push_back(value);
+    blockWeights.push_back(weight);
+    if (blockValues.size() >= kBlockSize) FlushBlock();
+  }
+
+  // Fix the binning and move exact counts into the histogram, after the last Fill
+  void Finalise();
+
+  // Set automatic limits from the values filled so far, as a full histogram
+  // buffer would, so accumulators copying the binning fill alike; exact
+  // counting is left as it is
+  void FixBinning();
+
+  // Add the values of another accumulator of the same branch; neither is finalised.
+  // Histograms of different binnings are combined by TH1::Merge, or at the
+  // bin centres of the other one if the bins do not line up, with a warning on out.
+  void Merge(const BranchAccumulator& other, std::ostream& out);
+
+  // Complete state of an accumulator filled from a tree, staged values included,
+  // in a binary form only read back by Deserialise of the same build
+  void Serialise(std::ostream& out) const;
+  static BranchAccumulator* Deserialise(std::istream& in); // null for a corrupt stream
+
+  TH1* GetHistogram() const { return hist; }
+
+  double GetEntries() const { return entries; }
+  double GetSumOfWeights() const { return sumw; }
+  double GetSumOfWeights2() const { return sumw2; }
+  double GetEffectiveEntries() const; // (sum w)^2 / sum w^2
+
+  double GetMean() const { return mean; }
+  double GetMeanError() const;
+  double GetStdDev() const;
+  double GetStdDevError() const;
+  double GetSkewness() const;
+  double GetMinimumValue() const { return minValue; }
+  double GetMaximumValue() const { return maxValue; }
+
+  // Exact counts per integer value, empty unless counted exactly
+  bool HasExactCounts() const { return exact; }
+  long long GetExactOffset() const { return exactOffset; }
+  const std::vector<double>& GetExactSumw() const { return exactSumw; }
+  const std::vector<double>& GetExactSumw2() const { return exactSumw2; }
+
+  // Largest span of integer values counted exactly before falling back to bins
+  static const long long kMaxExactValues = 1000;
+
+  // Values staged before a block is passed to the kernels
+  static const size_t kBlockSize = 1024;
+
+private:
+  BranchAccumulator(const BranchAccumulator&);
+  BranchAccumulator& operator=(const BranchAccumulator&);
+
+  void FlushBlock();
+  void MergeMoments(double blockSumw, double blockSumw2, double blockMean, double blockM2, double blockM3);
+  void FillExact(double value, double weight);
+  bool AddExactCount(long long value, double countSumw, double countSumw2); // false once beyond kMaxExactValues
+  void AddBinCount(double value, double countSumw, double countSumw2);
+  void ProjectExactCounts(); // add the exact counts to the (fixed) histogram binning
+  void StopExactCounting();
+
+  TH1 *hist;
+  bool binningFixed;
+  bool directFills; // bins written by the kernels, histogram statistics are stale
+  bool finalised;
+
+  // Current block of values and weights
+  std::vector<double> blockValues;
+  std::vector<double> blockWeights;
+
+  // Weighted central moments, merged block by block for numerical stability
+  double entries;
+  double sumw;
+  double sumw2;
+  double mean;
+  double m2; // sum w (x-mean)^2
+  double m3; // sum w (x-mean)^3
+  double minValue;
+  double maxValue;
+
+  // Dense exact counts, value = exactOffset + index
+  bool exact;
+  long long exactOffset;
+  std::vector<double> exactSumw;
+  std::vector<double> exactSumw2;
+};
+
+
+// Two-sample Chi2 p-value over the exactly counted values of both
+// accumulators, NaN unless both were counted exactly
+double ExactChi2Test(const BranchAccumulator& acc, const BranchAccumulator& refacc);
+
+#endif
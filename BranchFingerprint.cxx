@@ -0,0 +1,162 @@
+// Standard Library
+#include <cstring>
+#include <vector>
+
+#include "BranchFingerprint.h"
+
+// ROOT includes
+#include "TBasket.h"
+#include "TBranch.h"
+#include "TFile.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+
+namespace {
+  // 64-bit FNV-1a, streamed over the baskets of a branch
+  class ContentHash {
+  public:
+    ContentHash() : state(14695981039346656037ULL) {}
+    void Add(const char *data, size_t n) {
+      for (size_t i=0; i<n; ++i) {
+        state ^= (unsigned char) data[i];
+        state *= 1099511628211ULL;
+      }
+    }
+    unsigned long long Value() const { return state; }
+
+  private:
+    unsigned long long state;
+  };
+
+  // The tree cache is set aside while baskets are read directly, so that no
+  // cluster of the other branches is prefetched for them
+  class BypassCache {
+  public:
+    explicit BypassCache(TBranch *branch) : file(branch->GetFile()), tree(branch->GetTree()), cache(0) {
+      if (file) cache = file->GetCacheRead(tree);
+      if (cache) file->SetCacheRead(0, tree, TFile::kDoNotDisconnect);
+    }
+    ~BypassCache() {
+      if (cache) file->SetCacheRead(cache, tree, TFile::kDoNotDisconnect);
+    }
+
+  private:
+    BypassCache(const BypassCache&);
+    BypassCache& operator=(const BypassCache&);
+
+    TFile *file;
+    TTree *tree;
+    TFileCacheRead *cache;
+  };
+
+  // Same compression and basket boundaries, and no entries left in a basket
+  // stored with the tree header instead of on its own
+  bool SameBasketLayout(TBranch *branch, TBranch *refBranch) {
+    int nbaskets = branch->GetWriteBasket();
+    if (refBranch->GetWriteBasket() != nbaskets) return false;
+    if (branch->GetCompressionSettings() != refBranch->GetCompressionSettings()) return false;
+    Long64_t *entry = branch->GetBasketEntry();
+    Long64_t *refEntry = refBranch->GetBasketEntry();
+    for (int i=0; i<=nbaskets; ++i) {
+      if (entry[i] != refEntry[i]) return false;
+    }
+    return entry[nbaskets] == branch->GetEntries() && refEntry[nbaskets] == refBranch->GetEntries();
+  }
+
+  // Payload of a basket as stored in the file, after its key header; the key
+  // length is the big-endian short at byte 14 of the header
+  bool ReadCompressedBasket(TBranch *branch, int i, std::vector<char>& buffer, Int_t& keylen) {
+    Int_t nbytes = branch->GetBasketBytes()[i];
+    if (nbytes < 16) return false;
+    buffer.resize(nbytes);
+    if (branch->GetFile()->ReadBuffer(&buffer[0], branch->GetBasketSeek(i), nbytes)) return false;
+    keylen = ((unsigned char) buffer[14] << 8) | (unsigned char) buffer[15];
+    return keylen > 0 && keylen <= nbytes;
+  }
+
+  bool SameCompressedBaskets(TBranch *branch, TBranch *refBranch) {
+    BypassCache bypass(branch), refBypass(refBranch);
+    std::vector<char> buffer, refBuffer;
+    for (int i=0; i<branch->GetWriteBasket(); ++i) {
+      Int_t keylen, refKeylen;
+      if (!ReadCompressedBasket(branch, i, buffer, keylen) || !ReadCompressedBasket(refBranch, i, refBuffer, refKeylen)) return false;
+      size_t size = buffer.size() - keylen;
+      if (refBuffer.size() - refKeylen != size) return false;
+      if (size > 0 && std::memcmp(&buffer[keylen], &refBuffer[refKeylen], size) != 0) return false;
+    }
+    return true;
+  }
+
+  // Hashes of the values and of the entry sizes, kept apart so that they do
+  // not depend on where the baskets start; false if a basket cannot be read
+  bool HashContent(TBranch *branch, unsigned long long& values, unsigned long long& sizes) {
+    BypassCache bypass(branch);
+    ContentHash valueHash, sizeHash;
+    Long64_t entries = 0;
+    int nbaskets = branch->GetWriteBasket();
+    for (int i=0; i<=nbaskets; ++i) {
+      TBasket *basket = branch->GetBasket(i);
+      if (!basket) {
+        if (i < nbaskets) return false;
+        continue; // no entries after the last written basket
+      }
+      const char *buffer = basket->GetBufferRef()->Buffer();
+      Int_t keylen = basket->GetKeylen();
+      Int_t last = basket->GetLast();
+      Int_t nev = basket->GetNevBuf();
+      valueHash.Add(buffer + keylen, last - keylen);
+      Int_t *offsets = basket->GetEntryOffset();
+      for (Int_t j=0; offsets && j<nev; ++j) {
+        Int_t size = ((j+1 < nev) ? offsets[j+1] : last) - offsets[j];
+        sizeHash.Add((const char*) &size, sizeof(size));
+      }
+      entries += nev;
+      if (i < nbaskets) branch->DropBaskets("all");
+    }
+    values = valueHash.Value();
+    sizes = sizeHash.Value();
+    return entries == branch->GetEntries();
+  }
+}
+
+
+const char* BranchIdentityName(BranchIdentity identity) {
+  switch (identity) {
+    case kSameCompressedBaskets: return "same compressed baskets";
+    case kSameContent: return "same decompressed content";
+    default: return "different";
+  }
+}
+
+
+BranchIdentity CompareBranchBaskets(TBranch *branch, TBranch *refBranch) {
+  if (branch->GetEntries() != refBranch->GetEntries()) return kNotIdentical;
+  TObjArray *branches = branch->GetListOfBranches();
+  TObjArray *refBranches = refBranch->GetListOfBranches();
+  int nbranches = branches->GetEntriesFast();
+  if (refBranches->GetEntriesFast() != nbranches) return kNotIdentical;
+
+  // The top of a split branch keeps no values of its own
+  BranchIdentity identity = kSameCompressedBaskets;
+  bool ownBaskets = nbranches == 0 || branch->GetTotBytes() > 0 || refBranch->GetTotBytes() > 0;
+  if (ownBaskets && SameBasketLayout(branch, refBranch)) {
+    if (!SameCompressedBaskets(branch, refBranch)) return kNotIdentical;
+  }
+  else if (ownBaskets) {
+    unsigned long long values, sizes, refValues, refSizes;
+    if (!HashContent(branch, values, sizes) || !HashContent(refBranch, refValues, refSizes)) return kNotIdentical;
+    if (values != refValues || sizes != refSizes) return kNotIdentical;
+    identity = kSameContent;
+  }
+
+  for (int b=0; b<nbranches; ++b) {
+    TBranch *sub = (TBranch*) branches->At(b);
+    TBranch *refSub = (TBranch*) refBranches->At(b);
+    if (std::strcmp(sub->GetName(), refSub->GetName()) != 0) return kNotIdentical;
+    BranchIdentity subIdentity = CompareBranchBaskets(sub, refSub);
+    if (subIdentity == kNotIdentical) return kNotIdentical;
+    if (subIdentity == kSameContent) identity = kSameContent;
+  }
+  return identity;
+}
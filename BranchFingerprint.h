@@ -0,0 +1,26 @@
+#ifndef BRANCHFINGERPRINT_H
+#define BRANCHFINGERPRINT_H
+
+class TBranch;
+
+
+// How a branch was found to hold the same values in both files
+enum BranchIdentity {
+  kNotIdentical,          // different, or not proven identical
+  kSameCompressedBaskets, // same compression and basket boundaries, same compressed bytes
+  kSameContent            // same decompressed values and entry sizes
+};
+
+const char* BranchIdentityName(BranchIdentity identity);
+
+
+// Compares the baskets of a branch and its sub-branches in the input and
+// reference files, without filling anything. Written with the same
+// compression settings and basket boundaries, the compressed baskets are
+// compared as stored in the files, stopping at the first that differs.
+// Otherwise every basket is decompressed and its values and entry sizes are
+// hashed, so that branches rewritten with other compression or basket sizes
+// are still found identical. Baskets are read around the tree caches.
+BranchIdentity CompareBranchBaskets(TBranch *branch, TBranch *refBranch);
+
+#endif
@@ -0,0 +1,144 @@
+// Standard Library
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "Checkpoint.h"
+#include "BinaryIO.h"
+
+
+namespace {
+  const char kMagic[8] = {'S', 'V', 'T', 'C', 'K', 'P', 'T', '1'};
+}
+
+
+CheckpointStore::CheckpointStore(const std::string& dir, const std::string& input, const std::string& ref, double intervalSeconds)
+  : directory(dir), inputFile(input), refFile(ref), interval(intervalSeconds) {
+}
+
+
+std::string CheckpointStore::FileName(const std::string& treeName, int pass) const {
+  std::string name = treeName;
+  for (size_t i=0; i<name.size(); ++i) {
+    if (name[i] == '/') name[i] = '_';
+  }
+  std::ostringstream fileName;
+  fileName<<directory<<"/"<<name<<"."<<pass<<".ckpt";
+  return fileName.str();
+}
+
+
+void CheckpointStore::Register(const std::string& fileName) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i=0; i<files.size(); ++i) {
+    if (files[i] == fileName) return;
+  }
+  files.push_back(fileName);
+}
+
+
+bool CheckpointStore::Save(const std::string& treeName, int pass, const std::vector<std::string>& branchNames, int phase, Long64_t nextEntry,
+                           const std::vector<BranchAccumulator*>& accumulators, const std::vector<BranchAccumulator*>& refAccumulators,
+                           std::ostream& out) {
+  std::string fileName = FileName(treeName, pass);
+  std::string tmpName = fileName + ".tmp";
+  {
+    std::ofstream file(tmpName.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(kMagic, sizeof(kMagic));
+    WriteBinary(file, inputFile);
+    WriteBinary(file, refFile);
+    WriteBinary(file, treeName);
+    WriteBinary(file, pass);
+    WriteBinary(file, (unsigned long long) branchNames.size());
+    for (size_t i=0; i<branchNames.size(); ++i) WriteBinary(file, branchNames[i]);
+    WriteBinary(file, phase);
+    WriteBinary(file, nextEntry);
+    for (size_t i=0; i<branchNames.size(); ++i) {
+      accumulators[i]->Serialise(file);
+      bool hasReference = i < refAccumulators.size() && refAccumulators[i];
+      WriteBinary(file, hasReference);
+      if (hasReference) refAccumulators[i]->Serialise(file);
+    }
+    if (!file) {
+      out<<"WARNING: checkpoint "<<tmpName<<" cannot be written"<<std::endl;
+      return false;
+    }
+  }
+  // Replace the previous checkpoint only once the new one is complete
+  if (std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    out<<"WARNING: checkpoint "<<fileName<<" cannot be written"<<std::endl;
+    return false;
+  }
+  Register(fileName);
+  return true;
+}
+
+
+bool CheckpointStore::Load(const std::string& treeName, int pass, const std::vector<std::string>& branchNames, PassCheckpoint& checkpoint,
+                           std::ostream& out) {
+  std::string fileName = FileName(treeName, pass);
+  std::ifstream in(fileName.c_str(), std::ios::binary);
+  if (!in) return false;
+
+  char magic[sizeof(kMagic)];
+  std::string input, ref, tree;
+  int storedPass = -1;
+  unsigned long long nbranches = 0;
+  bool ok = in.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), kMagic)
+    && ReadBinary(in, input) && ReadBinary(in, ref) && ReadBinary(in, tree) && ReadBinary(in, storedPass)
+    && ReadBinary(in, nbranches);
+  bool same = ok && input == inputFile && ref == refFile && tree == treeName && storedPass == pass && nbranches == branchNames.size();
+  for (size_t i=0; same && i<branchNames.size(); ++i) {
+    std::string name;
+    same = ReadBinary(in, name) && name == branchNames[i];
+  }
+  if (!same) {
+    out<<"WARNING: checkpoint "<<fileName<<" does not match this comparison, starting the pass from the beginning"<<std::endl;
+    return false;
+  }
+
+  ok = ReadBinary(in, checkpoint.phase) && ReadBinary(in, checkpoint.nextEntry)
+    && checkpoint.phase >= PassCheckpoint::kInput && checkpoint.phase <= PassCheckpoint::kComplete;
+  checkpoint.accumulators.assign(branchNames.size(), (BranchAccumulator*)0);
+  checkpoint.refAccumulators.assign(branchNames.size(), (BranchAccumulator*)0);
+  for (size_t i=0; ok && i<branchNames.size(); ++i) {
+    checkpoint.accumulators[i] = BranchAccumulator::Deserialise(in);
+    bool hasReference = false;
+    ok = checkpoint.accumulators[i] && ReadBinary(in, hasReference);
+    if (ok && hasReference) {
+      checkpoint.refAccumulators[i] = BranchAccumulator::Deserialise(in);
+      ok = checkpoint.refAccumulators[i] != 0;
+    }
+  }
+  if (!ok) {
+    out<<"WARNING: checkpoint "<<fileName<<" is corrupt, starting the pass from the beginning"<<std::endl;
+    for (size_t i=0; i<branchNames.size(); ++i) {
+      delete checkpoint.accumulators[i];
+      delete checkpoint.refAccumulators[i];
+    }
+    return false;
+  }
+  Register(fileName);
+  return true;
+}
+
+
+void CheckpointStore::RemoveAll() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i=0; i<files.size(); ++i) std::remove(files[i].c_str());
+  files.clear();
+}
+
+
+PassCheckpointer::PassCheckpointer(CheckpointStore *checkpointStore, const std::string& tree, int passNumber,
+                                   const std::vector<std::string>& names, const std::vector<BranchAccumulator*>& inputs,
+                                   const std::vector<BranchAccumulator*>& references, std::ostream& log)
+  : FillProgress(checkpointStore->GetInterval()), phase(PassCheckpoint::kInput), store(checkpointStore),
+    treeName(tree), pass(passNumber), branchNames(names), accumulators(inputs), refAccumulators(references), out(log) {
+}
+
+
+void PassCheckpointer::Checkpoint(Long64_t nextEntry) {
+  store->Save(treeName, pass, branchNames, phase, nextEntry, accumulators, refAccumulators, out);
+}
@@ -0,0 +1,80 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Standard Library
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BranchAccumulator.h"
+#include "EventLoop.h"
+
+
+// State of one pass over the input and reference trees for a group of branches
+struct PassCheckpoint {
+  enum Phase { kInput = 0, kReference = 1, kComplete = 2 };
+
+  int phase;
+  Long64_t nextEntry; // first entry not yet read by the phase
+  std::vector<BranchAccumulator*> accumulators;    // owned by the caller after Load
+  std::vector<BranchAccumulator*> refAccumulators; // null for branches without reference
+};
+
+
+// Directory of checkpoint files, one per tree and pass, rewritten atomically.
+// Checkpoints are only resumed for the same input and reference files, tree,
+// pass and branches, and are removed once the whole comparison completed.
+class CheckpointStore {
+public:
+  CheckpointStore(const std::string& directory, const std::string& inputFile, const std::string& refFile, double intervalSeconds);
+
+  double GetInterval() const { return interval; }
+
+  // Failures are reported on out as warnings, the comparison goes on
+  bool Save(const std::string& treeName, int pass, const std::vector<std::string>& branchNames, int phase, Long64_t nextEntry,
+            const std::vector<BranchAccumulator*>& accumulators, const std::vector<BranchAccumulator*>& refAccumulators,
+            std::ostream& out);
+
+  // False if there is no matching checkpoint
+  bool Load(const std::string& treeName, int pass, const std::vector<std::string>& branchNames, PassCheckpoint& checkpoint,
+            std::ostream& out);
+
+  void RemoveAll();
+
+private:
+  std::string FileName(const std::string& treeName, int pass) const;
+  void Register(const std::string& fileName);
+
+  std::string directory;
+  std::string inputFile;
+  std::string refFile;
+  double interval;
+
+  std::mutex mutex; // passes of different trees are checkpointed from several threads
+  std::vector<std::string> files;
+};
+
+
+// Event loop hook saving the accumulators of a pass every checkpoint interval
+class PassCheckpointer : public FillProgress {
+public:
+  PassCheckpointer(CheckpointStore *checkpointStore, const std::string& tree, int passNumber,
+                   const std::vector<std::string>& names, const std::vector<BranchAccumulator*>& inputs,
+                   const std::vector<BranchAccumulator*>& references, std::ostream& log);
+
+  virtual void Checkpoint(Long64_t nextEntry);
+
+  int phase;
+
+private:
+  CheckpointStore *store;
+  std::string treeName;
+  int pass;
+  const std::vector<std::string>& branchNames;
+  const std::vector<BranchAccumulator*>& accumulators;
+  const std::vector<BranchAccumulator*>& refAccumulators;
+  std::ostream& out;
+};
+
+#endif
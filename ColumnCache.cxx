@@ -0,0 +1,322 @@
+// Standard Library
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "ColumnCache.h"
+
+// ROOT includes
+#include "TBranch.h"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TTree.h"
+
+
+namespace {
+  const char kColumnMagic[8] = "SVTCOL1";
+  const size_t kChunkValues = 1 << 16; // values buffered per column while building
+  std::atomic<unsigned long> nbuilds(0); // temporary files of concurrent runs in a daemon
+
+  struct ColumnHeader {
+    char magic[8];
+    unsigned long long keyLength;
+    unsigned long long entries;
+    unsigned long long nvalues;
+    unsigned long long exact;
+    unsigned long long hasOffsets;
+  };
+
+  size_t Padded(size_t size) { return (size + 7) & ~(size_t) 7; }
+
+  // Column file name from its key, 64-bit FNV-1a in hexadecimal
+  std::string KeyHash(const std::string& key) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i=0; i<key.size(); ++i) {
+      hash ^= (unsigned char) key[i];
+      hash *= 1099511628211ULL;
+    }
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", hash);
+    return text;
+  }
+
+  class ColumnFiller : public BranchFiller {
+  public:
+    ColumnFiller(const Column& mapped, BranchAccumulator *accumulator) : BranchFiller(accumulator), column(mapped) {}
+
+    virtual void Fill(Long64_t localEntry, double weight) {
+      if (!column.offsets) {
+        acc->Fill(column.values[localEntry], weight);
+        return;
+      }
+      for (unsigned long long j=column.offsets[localEntry]; j<column.offsets[localEntry+1]; ++j) {
+        acc->Fill(column.values[j], weight);
+      }
+    }
+
+    virtual void Notify(TTree *) {}
+
+  private:
+    const Column& column;
+  };
+
+  class ColumnReader : public ValueReader {
+  public:
+    explicit ColumnReader(const Column& mapped) : column(mapped) {}
+
+    virtual double Read(Long64_t localEntry) {
+      if (!column.offsets) return column.values[localEntry];
+      unsigned long long first = column.offsets[localEntry];
+      return (column.offsets[localEntry+1] > first) ? column.values[first] : 0;
+    }
+
+    virtual void Notify(TTree *) {}
+
+  private:
+    const Column& column;
+  };
+
+  // Column being built: values are buffered and appended to the file in chunks
+  struct ColumnBuild {
+    TBranch *branch;
+    TLeaf *leaf;
+    std::string fileName;
+    std::string tempName;
+    std::vector<double> buffer;
+    std::vector<unsigned long long> offsets; // arrays only
+    unsigned long long nvalues;
+    bool array;
+    bool ok;
+  };
+
+  void Append(ColumnBuild& build, const char *data, size_t size) {
+    std::ofstream file(build.tempName.c_str(), std::ios::binary | std::ios::app);
+    file.write(data, size);
+    build.ok = build.ok && file.good();
+  }
+
+  void AppendValues(ColumnBuild& build) {
+    if (!build.buffer.empty()) Append(build, (const char*) &build.buffer[0], build.buffer.size()*sizeof(double));
+    build.buffer.clear();
+  }
+}
+
+
+ColumnSet::~ColumnSet() {
+  for (std::map<std::string, Column>::iterator it=columns.begin(); it!=columns.end(); ++it) {
+    munmap(it->second.mapping, it->second.mappedSize);
+  }
+}
+
+
+BranchFiller* ColumnSet::CreateFiller(const std::string& branchName, BranchAccumulator *accumulator) const {
+  std::map<std::string, Column>::const_iterator it = columns.find(branchName);
+  if (it == columns.end()) return 0;
+  if (it->second.exact) accumulator->EnableExactCounting();
+  return new ColumnFiller(it->second, accumulator);
+}
+
+
+ValueReader* ColumnSet::CreateReader(const std::string& branchName) const {
+  std::map<std::string, Column>::const_iterator it = columns.find(branchName);
+  return (it == columns.end()) ? 0 : new ColumnReader(it->second);
+}
+
+
+ColumnCache::ColumnCache(const std::string& cacheDirectory, double maxCacheBytes)
+  : directory(cacheDirectory), maxBytes(maxCacheBytes) {
+}
+
+
+std::string ColumnCache::Key(TTree *tree, const std::string& branchName) const {
+  TFile *file = tree->GetCurrentFile();
+  struct stat status;
+  if (!file || stat(file->GetName(), &status) != 0) return "";
+  std::ostringstream key;
+  key<<file->GetUUID().AsString()<<" "<<status.st_size<<" "<<status.st_mtime<<" "
+     <<tree->GetName()<<" "<<tree->GetEntries()<<" "<<branchName;
+  return key.str();
+}
+
+
+std::string ColumnCache::FileName(const std::string& key) const {
+  return directory + "/" + KeyHash(key) + ".col";
+}
+
+
+bool ColumnCache::Map(const std::string& fileName, const std::string& key, Column& column) const {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat status;
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(ColumnHeader)) {
+    mapping = mmap(0, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+
+  // The key is checked in full, a hash collision only misses the cache
+  size_t size = status.st_size;
+  const char *base = (const char*) mapping;
+  const ColumnHeader *header = (const ColumnHeader*) mapping;
+  size_t valuesStart = sizeof(ColumnHeader) + Padded(key.size());
+  bool valid = std::memcmp(header->magic, kColumnMagic, sizeof(kColumnMagic)) == 0 && header->keyLength == key.size() &&
+               valuesStart <= size && std::memcmp(base + sizeof(ColumnHeader), key.data(), key.size()) == 0 &&
+               header->nvalues <= size/sizeof(double) && header->entries <= size/sizeof(unsigned long long);
+  size_t offsetsSize = header->hasOffsets ? (header->entries + 1)*sizeof(unsigned long long) : 0;
+  if (!valid || valuesStart + header->nvalues*sizeof(double) + offsetsSize != size) {
+    munmap(mapping, size);
+    return false;
+  }
+
+  column.mapping = mapping;
+  column.mappedSize = size;
+  column.entries = header->entries;
+  column.values = (const double*) (base + valuesStart);
+  column.offsets = header->hasOffsets ? (const unsigned long long*) (base + valuesStart + header->nvalues*sizeof(double)) : 0;
+  column.exact = header->exact;
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  utime(fileName.c_str(), 0); // recently used columns are evicted last
+  return true;
+}
+
+
+bool ColumnCache::Build(TTree *tree, const std::vector<std::string>& branchNames, const std::vector<std::string>& keys,
+                        const std::vector<bool>& exact, std::ostream& out) {
+  // Every column starts with its header, completed once the values are known, and its key
+  std::vector<ColumnBuild> builds(branchNames.size());
+  std::string suffix = ".tmp" + std::to_string(getpid()) + "." + std::to_string(++nbuilds);
+  for (size_t i=0; i<branchNames.size(); ++i) {
+    ColumnBuild& build = builds[i];
+    build.branch = tree->GetBranch(branchNames[i].c_str());
+    build.leaf = (TLeaf*) build.branch->GetListOfLeaves()->At(0);
+    build.fileName = FileName(keys[i]);
+    build.tempName = build.fileName + suffix;
+    build.nvalues = 0;
+    build.array = build.leaf->GetLeafCount() || build.leaf->GetLenStatic() > 1;
+    build.ok = true;
+    std::ofstream file(build.tempName.c_str(), std::ios::binary | std::ios::trunc);
+    ColumnHeader header = ColumnHeader();
+    std::string key = keys[i];
+    key.resize(Padded(key.size()), '\0');
+    file.write((const char*) &header, sizeof(header));
+    file.write(key.data(), key.size());
+    build.ok = file.good();
+  }
+
+  // One pass over the tree decompresses the baskets of all missing columns
+  Long64_t nentries = tree->GetEntries();
+  for (Long64_t entry=0; entry<nentries; ++entry) {
+    for (size_t i=0; i<builds.size(); ++i) {
+      ColumnBuild& build = builds[i];
+      build.branch->GetEntry(entry);
+      int ndata = build.leaf->GetLen(); // reads the leaf count of variable size arrays
+      if (build.array) build.offsets.push_back(build.nvalues);
+      for (int j=0; j<ndata; ++j) build.buffer.push_back(build.leaf->GetValue(j));
+      build.nvalues += ndata;
+      if (build.buffer.size() >= kChunkValues) AppendValues(build);
+    }
+  }
+
+  bool built = true;
+  for (size_t i=0; i<builds.size(); ++i) {
+    ColumnBuild& build = builds[i];
+    AppendValues(build);
+    if (build.array) {
+      build.offsets.push_back(build.nvalues);
+      Append(build, (const char*) &build.offsets[0], build.offsets.size()*sizeof(unsigned long long));
+    }
+    ColumnHeader header = ColumnHeader();
+    std::memcpy(header.magic, kColumnMagic, sizeof(kColumnMagic));
+    header.keyLength = keys[i].size();
+    header.entries = nentries;
+    header.nvalues = build.nvalues;
+    header.exact = exact[i];
+    header.hasOffsets = build.array;
+    {
+      std::fstream file(build.tempName.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+      file.write((const char*) &header, sizeof(header));
+      build.ok = build.ok && file.good();
+    }
+    // Complete columns appear at once under their final name
+    if (!build.ok || std::rename(build.tempName.c_str(), build.fileName.c_str()) != 0) {
+      std::remove(build.tempName.c_str());
+      out<<"WARNING: column of branch "<<branchNames[i]<<" could not be written to the column cache "<<directory<<std::endl;
+      built = false;
+    }
+  }
+  return built;
+}
+
+
+void ColumnCache::Evict() {
+  DIR *dir = opendir(directory.c_str());
+  if (!dir) return;
+  std::vector<std::pair<time_t, std::pair<std::string, double> > > files; // last use, name, bytes
+  double total = 0;
+  struct dirent *entry;
+  while ( (entry = readdir(dir)) ) {
+    std::string name = entry->d_name;
+    if (name.size() < 4 || name.compare(name.size()-4, 4, ".col") != 0) continue;
+    std::string path = directory + "/" + name;
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) continue;
+    files.push_back(std::make_pair(status.st_mtime, std::make_pair(path, (double) status.st_size)));
+    total += status.st_size;
+  }
+  closedir(dir);
+
+  std::sort(files.begin(), files.end());
+  for (size_t i=0; i<files.size() && total > maxBytes; ++i) {
+    if (std::remove(files[i].second.first.c_str()) == 0) total -= files[i].second.second;
+  }
+}
+
+
+void ColumnCache::Open(TTree *tree, const std::vector<std::string>& branchNames, ColumnSet& columns, std::ostream& out) {
+  if (tree->GetTree() != tree) return; // chains index their entries over several files
+
+  std::vector<std::string> missing, missingKeys;
+  std::vector<bool> missingExact;
+  for (size_t i=0; i<branchNames.size(); ++i) {
+    const std::string& branchName = branchNames[i];
+    bool exact;
+    if (columns.Has(branchName) || std::find(missing.begin(), missing.end(), branchName) != missing.end()) continue;
+    if (!IsPlainLeafBranch(tree, branchName, exact)) continue;
+    std::string key = Key(tree, branchName);
+    if (key.empty()) continue;
+    Column column;
+    if (Map(FileName(key), key, column)) columns.columns[branchName] = column;
+    else {
+      missing.push_back(branchName);
+      missingKeys.push_back(key);
+      missingExact.push_back(exact);
+    }
+  }
+  size_t mapped = columns.Size();
+
+  if (!missing.empty()) {
+    Build(tree, missing, missingKeys, missingExact, out);
+    for (size_t i=0; i<missing.size(); ++i) {
+      Column column;
+      if (Map(FileName(missingKeys[i]), missingKeys[i], column)) columns.columns[missing[i]] = column;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    Evict();
+  }
+
+  // Columns are read from the mappings, their baskets not prefetched again
+  for (std::map<std::string, Column>::const_iterator it=columns.columns.begin(); it!=columns.columns.end(); ++it) {
+    tree->DropBranchFromCache(it->first.c_str(), kTRUE);
+  }
+  out<<"Column cache: "<<mapped<<" columns of tree "<<tree->GetName()<<" mapped, "<<columns.Size()-mapped<<" built"<<std::endl;
+}
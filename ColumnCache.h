@@ -0,0 +1,83 @@
+#ifndef COLUMNCACHE_H
+#define COLUMNCACHE_H
+
+// Standard Library
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "FillKernels.h"
+
+class TTree;
+
+
+// Decompressed values of one plain branch, mapped from a cache file: every
+// value of the tree as a double, with per-entry offsets into them for arrays
+struct Column {
+  void *mapping;
+  size_t mappedSize;
+  unsigned long long entries;
+  const double *values;
+  const unsigned long long *offsets; // entries+1 offsets for arrays, null for one value per entry
+  bool exact; // integer leaf, counted exactly
+};
+
+
+// Columns of the branches of one tree, mapped for the time of a pass. Its
+// fillers and readers stand in for the typed kernels and read the values of
+// an entry straight from the mapped arrays, without any basket.
+class ColumnSet {
+public:
+  ColumnSet() {}
+  ~ColumnSet(); // unmaps the columns
+
+  bool Has(const std::string& branchName) const { return columns.count(branchName) > 0; }
+  size_t Size() const { return columns.size(); }
+
+  // Null for a branch without column
+  BranchFiller* CreateFiller(const std::string& branchName, BranchAccumulator *accumulator) const;
+  ValueReader* CreateReader(const std::string& branchName) const;
+
+private:
+  ColumnSet(const ColumnSet&);
+  ColumnSet& operator=(const ColumnSet&);
+
+  friend class ColumnCache;
+  std::map<std::string, Column> columns;
+};
+
+
+// On-disk cache of decompressed columns, for repeated runs over the same
+// files with other branch selections, cuts or binnings. A column file is
+// keyed by the identity of the ROOT file (UUID, size and modification
+// time), the tree and the branch, and holds a header, the key, the values as
+// doubles and the entry offsets of arrays, all 8-byte aligned for mmap.
+// Columns missing from the cache are built in one pass over the tree, written
+// under a temporary name and renamed, so concurrent runs never map half a
+// file. Once the cache exceeds its size the least recently used columns are
+// removed; mapped columns stay readable until unmapped.
+class ColumnCache {
+public:
+  ColumnCache(const std::string& directory, double maxBytes);
+
+  // Map the columns of the plain branches among branchNames, building the
+  // missing ones, and take them out of the tree cache. Other branches and
+  // expressions are left to the event loop.
+  void Open(TTree *tree, const std::vector<std::string>& branchNames, ColumnSet& columns, std::ostream& out);
+
+private:
+  std::string Key(TTree *tree, const std::string& branchName) const;
+  std::string FileName(const std::string& key) const;
+  bool Map(const std::string& fileName, const std::string& key, Column& column) const;
+  bool Build(TTree *tree, const std::vector<std::string>& branchNames, const std::vector<std::string>& keys,
+             const std::vector<bool>& exact, std::ostream& out);
+  void Evict();
+
+  std::string directory;
+  double maxBytes;
+  std::mutex mutex; // builds and evictions of concurrent tree jobs
+};
+
+#endif
@@ -0,0 +1,182 @@
+// Standard Library
+#include <fstream>
+#include <sstream>
+
+#include "ComparisonSpec.h"
+
+
+BranchSpec::BranchSpec()
+  : nbins(100), lowLimit(0), highLimit(-9999) {
+  // Opt-in tests only run when a spec names them
+  std::vector<std::string> names = DefaultTestNames();
+  for (size_t i=0; i<names.size(); ++i) tests.push_back(FindComparisonTest(names[i]));
+}
+
+
+bool BranchSpec::HasTest(const std::string& name) const {
+  for (size_t i=0; i<tests.size(); ++i) {
+    if (name == tests[i]->name) return true;
+  }
+  return false;
+}
+
+
+ComparisonSpec::ComparisonSpec(const BranchSpec& defaultSpec)
+  : defaults(defaultSpec) {
+}
+
+
+namespace {
+  std::string Trim(const std::string& s) {
+    size_t first = s.find_first_not_of(" \t\r");
+    if (first == std::string::npos) return "";
+    size_t last = s.find_last_not_of(" \t\r");
+    return s.substr(first, last - first + 1);
+  }
+
+  bool ParseNumber(const std::string& text, double& value) {
+    std::istringstream in(text);
+    char rest;
+    return (in >> value) && !(in >> rest);
+  }
+}
+
+
+bool ComparisonSpec::Apply(BranchSpec& spec, const Setting& setting, std::string& error) {
+  const std::string& key = setting.first;
+  const std::string& value = setting.second;
+  double number = 0;
+  if (key == "bins") {
+    if (!ParseNumber(value, number) || number < 1 || number != (int)number) {
+      error = "bins must be a positive integer";
+      return false;
+    }
+    spec.nbins = (int)number;
+  }
+  else if (key == "range") {
+    std::istringstream in(value);
+    double low, high;
+    char rest;
+    if (value == "auto") {
+      spec.lowLimit = 0;
+      spec.highLimit = -9999;
+    }
+    else if ((in >> low >> high) && !(in >> rest) && low < high) {
+      spec.lowLimit = low;
+      spec.highLimit = high;
+    }
+    else {
+      error = "range must be auto or <low> <high> with low < high";
+      return false;
+    }
+  }
+  else if (key == "selection") spec.selection = value;
+  else if (key == "weight") spec.weight = spec.refWeight = value; // as --refWeight defaults to --weight
+  else if (key == "refWeight") spec.refWeight = value;
+  else if (key == "tests") {
+    std::string names = value;
+    for (size_t i=0; i<names.size(); ++i) {
+      if (names[i] == ',') names[i] = ' ';
+    }
+    std::istringstream in(names);
+    std::string name;
+    spec.tests.clear();
+    while (in >> name) {
+      const ComparisonTest *test = FindComparisonTest(name);
+      if (!test) {
+        error = "unknown test "+name;
+        return false;
+      }
+      spec.tests.push_back(test);
+    }
+  }
+  else if (key == "meanWindow" || key == "stdErrorTolerance" || key == "meanErrorWindow" || key == "wassersteinWindow") {
+    if (!ParseNumber(value, number) || number < 0) {
+      error = key+" must be a non-negative number";
+      return false;
+    }
+    if (key == "meanWindow") spec.thresholds.meanWindow = number;
+    else if (key == "stdErrorTolerance") spec.thresholds.stdErrorTolerance = number;
+    else if (key == "meanErrorWindow") spec.thresholds.meanErrorWindow = number;
+    else spec.thresholds.wassersteinWindow = number;
+  }
+  else {
+    error = "unknown setting "+key;
+    return false;
+  }
+  return true;
+}
+
+
+bool ComparisonSpec::Parse(const std::string& fileName, std::ostream& out) {
+  std::ifstream in(fileName.c_str());
+  if (!in) {
+    out<<"Error: spec file "<<fileName<<" cannot be read"<<std::endl;
+    return false;
+  }
+
+  std::string line;
+  int lineNumber = 0;
+  Rule *rule = 0; // null: defaults
+  while (std::getline(in, line)) {
+    ++lineNumber;
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+    line = Trim(line);
+    if (line.empty()) continue;
+
+    std::string error;
+    if (line[0] == '[') {
+      if (line[line.size()-1] != ']' || line.size() < 3) error = "section must be [<regular expression>]";
+      else {
+        Rule section;
+        section.pattern = Trim(line.substr(1, line.size()-2));
+        try {
+          section.regex = std::regex(section.pattern);
+          rules.push_back(section);
+          rule = &rules.back();
+        }
+        catch (const std::regex_error&) {
+          error = "invalid regular expression "+section.pattern;
+        }
+      }
+    }
+    else {
+      size_t equals = line.find('=');
+      if (equals == std::string::npos) error = "expected <setting> = <value>";
+      else {
+        Setting setting(Trim(line.substr(0, equals)), Trim(line.substr(equals+1)));
+        BranchSpec check;
+        if (Apply(check, setting, error)) (rule ? rule->settings : defaultSettings).push_back(setting);
+      }
+    }
+    if (!error.empty()) {
+      out<<"Error: "<<fileName<<":"<<lineNumber<<": "<<error<<std::endl;
+      return false;
+    }
+  }
+  ApplySection(defaults, defaultSettings);
+  return true;
+}
+
+
+void ComparisonSpec::ApplySection(BranchSpec& spec, const std::vector<Setting>& settings) {
+  // refWeight last, so a weight of the same section does not override it
+  std::string error;
+  for (size_t k=0; k<settings.size(); ++k) {
+    if (settings[k].first != "refWeight") Apply(spec, settings[k], error); // checked by Parse
+  }
+  for (size_t k=0; k<settings.size(); ++k) {
+    if (settings[k].first == "refWeight") Apply(spec, settings[k], error);
+  }
+}
+
+
+BranchSpec ComparisonSpec::Resolve(const std::string& branchName, const std::string& qualifiedName) const {
+  BranchSpec spec = defaults;
+  for (size_t i=0; i<rules.size(); ++i) {
+    if (!std::regex_match(branchName, rules[i].regex) && !std::regex_match(qualifiedName, rules[i].regex)) continue;
+    ApplySection(spec, rules[i].settings);
+  }
+  return spec;
+}
@@ -0,0 +1,75 @@
+#ifndef COMPARISONSPEC_H
+#define COMPARISONSPEC_H
+
+// Standard Library
+#include <ostream>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ComparisonTests.h"
+
+
+// How one branch is filled and judged
+struct BranchSpec {
+  int nbins;
+  double lowLimit;  // lowLimit >= highLimit: automatic limits
+  double highLimit;
+  std::string selection; // TTree formula, empty for all events
+  std::string weight;    // TTree formulas, empty for unit weights
+  std::string refWeight;
+  std::vector<const ComparisonTest*> tests;
+  TestThresholds thresholds;
+
+  BranchSpec();
+  bool HasTest(const std::string& name) const;
+};
+
+
+// Declarative comparison spec, read once from a file of sections:
+//
+//   # defaults for every branch
+//   bins = 100
+//   tests = mean stdError meanError minMax ks chi2
+//
+//   [energy.*]          # branches matching the regular expression
+//   range = 0 3.5
+//   selection = nhits > 0
+//   weight = evweight
+//   meanWindow = 2
+//
+// Settings before the first section apply to all branches. A section applies
+// to branches whose name, or <tree>/<branch> name, fully matches its regular
+// expression; later sections override earlier ones. Keys: bins, range
+// (<low> <high> or auto), selection, weight (also of the reference unless the
+// section sets refWeight), refWeight, tests, meanWindow, stdErrorTolerance,
+// meanErrorWindow, wassersteinWindow.
+class ComparisonSpec {
+public:
+  explicit ComparisonSpec(const BranchSpec& defaults);
+
+  // Read the spec; prints an error with its line number to out and returns false on failure
+  bool Parse(const std::string& fileName, std::ostream& out);
+
+  // Settings of one branch, the execution plan entry of the branch
+  BranchSpec Resolve(const std::string& branchName, const std::string& qualifiedName) const;
+
+private:
+  typedef std::pair<std::string, std::string> Setting;
+
+  struct Rule {
+    std::string pattern;
+    std::regex regex;
+    std::vector<Setting> settings;
+  };
+
+  static bool Apply(BranchSpec& spec, const Setting& setting, std::string& error);
+  static void ApplySection(BranchSpec& spec, const std::vector<Setting>& settings);
+
+  BranchSpec defaults;
+  std::vector<Setting> defaultSettings;
+  std::vector<Rule> rules;
+};
+
+#endif
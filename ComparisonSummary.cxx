@@ -0,0 +1,159 @@
+// Standard Library
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <map>
+
+#include "ComparisonSummary.h"
+
+
+namespace {
+  const char* CorrectionName(ComparisonSummary::Correction method) {
+    switch (method) {
+      case ComparisonSummary::kBonferroni: return "Bonferroni";
+      case ComparisonSummary::kHolm: return "Holm";
+      case ComparisonSummary::kBenjaminiHochberg: return "Benjamini-Hochberg";
+    }
+    return "";
+  }
+
+  bool ValidPValue(double p) {
+    return !std::isnan(p) && p >= 0 && p <= 1;
+  }
+
+  struct PValueOrder {
+    const std::vector<double> *pvalues;
+    bool operator()(size_t a, size_t b) const { return (*pvalues)[a] < (*pvalues)[b]; }
+  };
+}
+
+
+ComparisonSummary::ComparisonSummary(Correction correction, double significance, size_t worst)
+  : method(correction), alpha(significance), nWorst(worst) {
+}
+
+
+bool ComparisonSummary::ParseCorrection(const std::string& name, Correction& correction) {
+  if (name == "bonferroni") correction = kBonferroni;
+  else if (name == "holm") correction = kHolm;
+  else if (name == "bh" || name == "fdr") correction = kBenjaminiHochberg;
+  else return false;
+  return true;
+}
+
+
+void ComparisonSummary::Add(const std::string& branchName, const std::string& testName, double pvalue) {
+  Entry entry;
+  entry.branch = branchName;
+  entry.test = testName;
+  entry.pvalue = pvalue;
+  entries.push_back(entry);
+}
+
+
+void ComparisonSummary::AddIdentical(const std::string& branchName) {
+  identical.push_back(branchName);
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  BranchResult result = {branchName, nan, nan, nan, nan, nan, nan, nan, nan,
+                         nan, nan, nan, nan, nan, nan, nan, nan, 1, 1, 1, nan, nan, true};
+  results.push_back(result);
+}
+
+
+void ComparisonSummary::Merge(const ComparisonSummary& other) {
+  entries.insert(entries.end(), other.entries.begin(), other.entries.end());
+  results.insert(results.end(), other.results.begin(), other.results.end());
+  identical.insert(identical.end(), other.identical.begin(), other.identical.end());
+}
+
+
+std::vector<double> ComparisonSummary::AdjustedPValues() const {
+  std::vector<double> adjusted(entries.size(), std::numeric_limits<double>::quiet_NaN());
+
+  // Only valid p-values take part in the family of tests
+  std::vector<double> pvalues(entries.size());
+  std::vector<size_t> order;
+  for (size_t i=0; i<entries.size(); ++i) {
+    pvalues[i] = entries[i].pvalue;
+    if (ValidPValue(pvalues[i])) order.push_back(i);
+  }
+  PValueOrder byPValue;
+  byPValue.pvalues = &pvalues;
+  std::stable_sort(order.begin(), order.end(), byPValue);
+
+  double m = order.size();
+  if (method == kBonferroni) {
+    for (size_t k=0; k<order.size(); ++k) {
+      adjusted[order[k]] = std::min(1.0, m*pvalues[order[k]]);
+    }
+  }
+  else if (method == kHolm) {
+    // Step-down: running maximum of (m-k) p_(k)
+    double running = 0;
+    for (size_t k=0; k<order.size(); ++k) {
+      running = std::max(running, std::min(1.0, (m-k)*pvalues[order[k]]));
+      adjusted[order[k]] = running;
+    }
+  }
+  else {
+    // Step-up: running minimum of m p_(k) / k from the largest p-value down
+    double running = 1;
+    for (size_t k=order.size(); k>0; --k) {
+      running = std::min(running, m*pvalues[order[k-1]]/k);
+      adjusted[order[k-1]] = running;
+    }
+  }
+  return adjusted;
+}
+
+
+void ComparisonSummary::Print(std::ostream& out) const {
+  std::vector<double> adjusted = AdjustedPValues();
+
+  size_t ntests = 0;
+  size_t rawSignificant = 0;
+  size_t significant = 0;
+  // Most discrepant test per branch, ranked on the adjusted p-value
+  std::map<std::string, size_t> worstPerBranch;
+  for (size_t i=0; i<entries.size(); ++i) {
+    if (!ValidPValue(entries[i].pvalue)) continue;
+    ++ntests;
+    if (entries[i].pvalue < alpha) ++rawSignificant;
+    if (adjusted[i] < alpha) ++significant;
+    std::map<std::string, size_t>::iterator it = worstPerBranch.find(entries[i].branch);
+    if (it == worstPerBranch.end()) worstPerBranch[entries[i].branch] = i;
+    else if (adjusted[i] < adjusted[it->second]) it->second = i;
+  }
+
+  std::vector<size_t> ranked;
+  for (std::map<std::string, size_t>::const_iterator it=worstPerBranch.begin(); it!=worstPerBranch.end(); ++it) {
+    ranked.push_back(it->second);
+  }
+  PValueOrder byAdjusted;
+  byAdjusted.pvalues = &adjusted;
+  std::stable_sort(ranked.begin(), ranked.end(), byAdjusted);
+
+  out<<"==== Global summary ===="<<std::endl;
+  out<<"Branches compared: "<<worstPerBranch.size()<<" ; p-values: "<<ntests<<std::endl;
+  out<<"Correction: "<<CorrectionName(method)<<" at alpha = "<<alpha<<std::endl;
+  out<<"Significant before correction: "<<rawSignificant<<" ; after correction: "<<significant<<std::endl;
+  size_t nfailed = 0;
+  for (size_t i=0; i<results.size(); ++i) {
+    if (!results[i].pass) ++nfailed;
+  }
+  out<<"Branches failing the example tests: "<<nfailed<<std::endl;
+  if (!identical.empty()) out<<"Branches identical in both files, not tested: "<<identical.size()<<std::endl;
+  out<<""<<std::endl;
+
+  size_t nshow = std::min(nWorst, ranked.size());
+  if (nshow > 0) {
+    out<<"Most discrepant branches:"<<std::endl;
+    for (size_t k=0; k<nshow; ++k) {
+      const Entry& entry = entries[ranked[k]];
+      out<<std::setw(4)<<(k+1)<<". "<<entry.branch<<" ("<<entry.test<<") p-value: "<<entry.pvalue
+         <<" ; adjusted: "<<adjusted[ranked[k]]<<(adjusted[ranked[k]] < alpha ? "  <-- significant" : "")<<std::endl;
+    }
+    out<<""<<std::endl;
+  }
+}
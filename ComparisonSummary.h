@@ -0,0 +1,66 @@
+#ifndef COMPARISONSUMMARY_H
+#define COMPARISONSUMMARY_H
+
+// Standard Library
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Statistics of one branch comparison, as printed by CompareHistogram
+struct BranchResult {
+  std::string branch;
+  double mean, meanError, std, stdError, skewness, neff, max, min;
+  double refMean, refMeanError, refStd, refStdError, refSkewness, refNeff, refMax, refMin; // max, min scaled to the input
+  double ks, chi2; // p-values, bootstrap ones when resampling is enabled
+  double ad;       // Anderson-Darling p-value, asymptotic
+  double adStatistic, wasserstein; // Anderson-Darling statistic, Wasserstein-1 distance
+  bool pass;       // verdict of the example tests
+};
+
+
+// Collects the p-values of all branch comparisons and reports them after a
+// multiple-comparison correction, so that the expected few percent of chance
+// failures over hundreds of branches are not flagged individually.
+class ComparisonSummary {
+public:
+  enum Correction { kBonferroni, kHolm, kBenjaminiHochberg };
+
+  ComparisonSummary(Correction method, double alpha, size_t nWorst);
+
+  // Parse "bonferroni", "holm" or "bh"; returns false for unknown names
+  static bool ParseCorrection(const std::string& name, Correction& method);
+
+  void Add(const std::string& branchName, const std::string& testName, double pvalue);
+  void AddResult(const BranchResult& result) { results.push_back(result); }
+  const std::vector<BranchResult>& GetResults() const { return results; }
+
+  // Branches holding the same values in both files, reported but not tested;
+  // their result passes with p-values of 1 and no moments (NaN), so a result
+  // store still lists them
+  void AddIdentical(const std::string& branchName);
+
+  // Append the p-values and results collected by another summary
+  void Merge(const ComparisonSummary& other);
+
+  // Adjusted p-values in the order the tests were added (NaN for invalid p-values)
+  std::vector<double> AdjustedPValues() const;
+
+  void Print(std::ostream& out) const;
+
+private:
+  struct Entry {
+    std::string branch;
+    std::string test;
+    double pvalue;
+  };
+
+  Correction method;
+  double alpha;
+  size_t nWorst;
+  std::vector<Entry> entries;
+  std::vector<BranchResult> results;
+  std::vector<std::string> identical;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "ComparisonTests.h"
+
+
+namespace {
+  // Both means should lie within the window of reference standard deviations
+  bool MeanTest(const BranchResult& r, const TestThresholds& t, std::ostream& out) {
+    double window = t.meanWindow*r.refStd;
+    if (r.mean>(r.refMean+window) || r.mean<(r.refMean-window)) {
+      out<<"Error: Mean outside of "<<t.meanWindow<<" Standard Deviation"<<std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Arbitrary account of the difference in std error
+  bool StdErrorTest(const BranchResult& r, const TestThresholds& t, std::ostream& out) {
+    double high = 1 + t.stdErrorTolerance;
+    double low = 1 - t.stdErrorTolerance;
+    if ((r.stdError/r.refStdError)>high || (r.refStdError/r.stdError)>high ||
+        (r.refStdError/r.stdError)<low || (r.stdError/r.refStdError)<low) {
+      out<<"Error: Standard Deviation Error to large"<<std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Mean values and Errors on Mean Values
+  bool MeanErrorTest(const BranchResult& r, const TestThresholds& t, std::ostream& out) {
+    double k = t.meanErrorWindow;
+    if (r.mean>(r.refMean+k*r.refMeanError) || r.mean<(r.refMean-k*r.refMeanError) ||
+        r.refMean>(r.mean+k*r.meanError) || r.refMean<(r.mean-k*r.meanError)) {
+      out<<"Error: Mean Value outside error bounds"<<std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Simple Tests on Max and Min
+  bool MinMaxTest(const BranchResult& r, const TestThresholds&, std::ostream& out) {
+    if (r.max<r.refMin || r.refMax<r.min) {
+      out<<"Error: Max, Min reversed"<<std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Distance between the distributions within a window of reference standard deviations
+  bool WassersteinTest(const BranchResult& r, const TestThresholds& t, std::ostream& out) {
+    if (r.wasserstein > t.wassersteinWindow*r.refStd) {
+      out<<"Error: Wasserstein distance above "<<t.wassersteinWindow<<" Standard Deviation"<<std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  double KolmogorovPValue(const BranchResult& r) { return r.ks; }
+  double Chi2PValue(const BranchResult& r) { return r.chi2; }
+  double AndersonDarlingPValue(const BranchResult& r) { return r.ad; }
+
+  std::vector<ComparisonTest> MakeTests() {
+    ComparisonTest tests[] = {
+      {"mean", "means within meanWindow reference standard deviations", &MeanTest, 0, 0, false},
+      {"stdError", "standard deviation errors agree within stdErrorTolerance", &StdErrorTest, 0, 0, false},
+      {"meanError", "means within meanErrorWindow errors of each other", &MeanErrorTest, 0, 0, false},
+      {"minMax", "maximum and minimum not reversed", &MinMaxTest, 0, 0, false},
+      {"ks", "Kolmogorov-Smirnov p-value", 0, &KolmogorovPValue, "Kolmogorov", false},
+      {"chi2", "Chi2 test p-value", 0, &Chi2PValue, "Chi2", false},
+      {"wasserstein", "Wasserstein distance within wassersteinWindow reference standard deviations", &WassersteinTest, 0, 0, true},
+      {"ad", "Anderson-Darling p-value", 0, &AndersonDarlingPValue, "Anderson-Darling", true}
+    };
+    return std::vector<ComparisonTest>(tests, tests + sizeof(tests)/sizeof(ComparisonTest));
+  }
+}
+
+
+const std::vector<ComparisonTest>& ComparisonTests() {
+  static const std::vector<ComparisonTest> tests = MakeTests();
+  return tests;
+}
+
+
+const ComparisonTest* FindComparisonTest(const std::string& name) {
+  const std::vector<ComparisonTest>& tests = ComparisonTests();
+  for (size_t i=0; i<tests.size(); ++i) {
+    if (name == tests[i].name) return &tests[i];
+  }
+  return 0;
+}
+
+
+std::vector<std::string> DefaultTestNames() {
+  const std::vector<ComparisonTest>& tests = ComparisonTests();
+  std::vector<std::string> names;
+  for (size_t i=0; i<tests.size(); ++i) {
+    if (!tests[i].optIn) names.push_back(tests[i].name);
+  }
+  return names;
+}
@@ -0,0 +1,46 @@
+#ifndef COMPARISONTESTS_H
+#define COMPARISONTESTS_H
+
+// Standard Library
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ComparisonSummary.h"
+
+
+// Thresholds of the verdict tests, settable per branch by the spec file
+struct TestThresholds {
+  double meanWindow;        // mean: window in reference standard deviations
+  double stdErrorTolerance; // stdError: largest relative difference of the std errors
+  double meanErrorWindow;   // meanError: window in errors on the mean
+  double wassersteinWindow; // wasserstein: largest distance in reference standard deviations
+
+  TestThresholds() : meanWindow(1), stdErrorTolerance(0.01), meanErrorWindow(1), wassersteinWindow(0.1) {}
+};
+
+
+// A named test run on every branch comparison. Verdict tests decide the
+// pass flag of the branch and print an "Error:" line when they fail;
+// p-value tests hand their p-value to the summary, which judges all of them
+// together after the multiple-comparison correction.
+struct ComparisonTest {
+  const char *name;        // as used in the spec file
+  const char *description;
+  bool (*verdict)(const BranchResult& result, const TestThresholds& thresholds, std::ostream& out);
+  double (*pvalue)(const BranchResult& result);
+  const char *summaryName; // p-value tests: name in the summary
+  bool optIn;              // only run when named in the spec, not by default
+};
+
+
+// All tests, in the order they are run
+const std::vector<ComparisonTest>& ComparisonTests();
+
+// Null if no test has this name
+const ComparisonTest* FindComparisonTest(const std::string& name);
+
+// Names of the tests run by default, all but the opt-in ones
+std::vector<std::string> DefaultTestNames();
+
+#endif
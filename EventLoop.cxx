@@ -0,0 +1,173 @@
+#include "EventLoop.h"
+#include "ColumnCache.h"
+
+// ROOT includes
+#include "TTree.h"
+#include "TTreeFormula.h"
+
+
+// Distinct expressions of all fill conditions, each compiled once.
+// Plain branch names are read directly, only other expressions need a
+// TTreeFormula.
+class FormulaSet {
+public:
+  ~FormulaSet() {
+    for (size_t i=0; i<formulas.size(); ++i) {
+      delete readers[i];
+      delete formulas[i];
+    }
+  }
+
+  // Index of the compiled expression, -1 for an empty one, -2 if it does not compile
+  int Add(const std::string& expression, TTree *tree, const ColumnSet *columns, std::ostream& out) {
+    if (expression.empty()) return -1;
+    for (size_t i=0; i<expressions.size(); ++i) {
+      if (expressions[i] == expression) return i;
+    }
+    ValueReader *reader = columns ? columns->CreateReader(expression) : 0;
+    if (!reader) reader = CreateValueReader(tree, expression);
+    TTreeFormula *formula = 0;
+    if (!reader) {
+      formula = new TTreeFormula(("condition_"+expression).c_str(), expression.c_str(), tree);
+      if (formula->GetNdim() == 0) {
+        out<<"Error: expression "<<expression<<" cannot be evaluated on tree "<<tree->GetName()<<std::endl;
+        delete formula;
+        return -2;
+      }
+    }
+    expressions.push_back(expression);
+    readers.push_back(reader);
+    formulas.push_back(formula);
+    values.push_back(0);
+    return expressions.size() - 1;
+  }
+
+  void Notify(TTree *current) {
+    for (size_t i=0; i<formulas.size(); ++i) {
+      if (readers[i]) readers[i]->Notify(current);
+      else formulas[i]->UpdateFormulaLeaves();
+    }
+  }
+
+  // Read every expression once for the current entry
+  void Evaluate(Long64_t localEntry) {
+    for (size_t i=0; i<formulas.size(); ++i) {
+      if (readers[i]) values[i] = readers[i]->Read(localEntry);
+      else values[i] = (formulas[i]->GetNdata() > 0) ? formulas[i]->EvalInstance(0) : 0;
+    }
+  }
+
+  double Value(int index, double empty) const { return (index < 0) ? empty : values[index]; }
+
+private:
+  std::vector<std::string> expressions;
+  std::vector<ValueReader*> readers; // null where a formula is used
+  std::vector<TTreeFormula*> formulas;
+  std::vector<double> values;
+};
+
+
+FillProgress::FillProgress(double intervalSeconds)
+  : interval(intervalSeconds), last(std::chrono::steady_clock::now()) {
+}
+
+
+bool FillProgress::Due() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (now - last < interval) return false;
+  last = now;
+  return true;
+}
+
+
+EventLoop::EventLoop(TTree *loopTree, const std::vector<std::string>& branchNames,
+                     const std::vector<BranchAccumulator*>& accumulators,
+                     const std::vector<FillCondition>& conditions, std::ostream& out, const ColumnSet *columns)
+  : tree(loopTree), formulas(new FormulaSet), selections(branchNames.size()), weights(branchNames.size()),
+    treeNumber(-1), treeWeight(1), valid(true) {
+  // Compile each distinct selection and weight once for the whole loop
+  for (size_t i=0; i<branchNames.size(); ++i) {
+    selections[i] = formulas->Add(conditions[i].selection, tree, columns, out);
+    weights[i] = formulas->Add(conditions[i].weight, tree, columns, out);
+    if (selections[i] == -2 || weights[i] == -2) {
+      valid = false;
+      return;
+    }
+  }
+
+  // Fill kernels are dispatched once per branch, from the leaf type, unless the branch has a mapped column
+  fillers.assign(branchNames.size(), (BranchFiller*)0);
+  for (size_t i=0; i<branchNames.size(); ++i) {
+    if (columns) fillers[i] = columns->CreateFiller(branchNames[i], accumulators[i]);
+    if (!fillers[i]) fillers[i] = CreateBranchFiller(tree, branchNames[i], accumulators[i]);
+    if (!fillers[i]) {
+      out<<"WARNING: branch "<<branchNames[i]<<" cannot be histogrammed. No comparison statistics will be made for this branch"<<std::endl;
+    }
+  }
+}
+
+
+EventLoop::~EventLoop() {
+  for (size_t i=0; i<fillers.size(); ++i) delete fillers[i];
+  delete formulas;
+}
+
+
+void EventLoop::SetAccumulators(const std::vector<BranchAccumulator*>& accumulators) {
+  for (size_t i=0; i<fillers.size(); ++i) {
+    if (fillers[i]) fillers[i]->SetAccumulator(accumulators[i]);
+  }
+}
+
+
+void EventLoop::Fill(Long64_t firstEntry, Long64_t lastEntry, FillProgress *progress, std::atomic<Long64_t> *entriesRead) {
+  Long64_t nentries = tree->GetEntries();
+  if (lastEntry >= 0 && lastEntry < nentries) nentries = lastEntry;
+  Long64_t counted = firstEntry; // entries already added to entriesRead
+  Long64_t entry;
+  for (entry=firstEntry; entry<nentries; ++entry) {
+    // Counters and the clock are only looked at every few thousand entries
+    if ((entry & 4095) == 0 && entry > firstEntry) {
+      if (entriesRead) {
+        *entriesRead += entry - counted;
+        counted = entry;
+      }
+      if (progress && progress->Due()) progress->Checkpoint(entry);
+    }
+
+    Long64_t localEntry = tree->LoadTree(entry);
+    if (localEntry < 0) break;
+
+    // Chains switch trees underneath the formulas
+    if (tree->GetTreeNumber() != treeNumber) {
+      treeNumber = tree->GetTreeNumber();
+      treeWeight = tree->GetWeight();
+      formulas->Notify(tree->GetTree());
+      for (size_t i=0; i<fillers.size(); ++i) {
+        if (fillers[i]) fillers[i]->Notify(tree->GetTree());
+      }
+    }
+
+    // Read the event selections and weights once, shared by every branch
+    formulas->Evaluate(localEntry);
+
+    for (size_t i=0; i<fillers.size(); ++i) {
+      if (!fillers[i] || formulas->Value(selections[i], 1) == 0) continue;
+      fillers[i]->Fill(localEntry, treeWeight*formulas->Value(weights[i], 1));
+    }
+  }
+  if (entriesRead) *entriesRead += entry - counted;
+}
+
+
+bool FillAccumulators(TTree *tree, const std::vector<std::string>& branchNames,
+                      const std::vector<BranchAccumulator*>& accumulators,
+                      const std::vector<FillCondition>& conditions, std::ostream& out,
+                      Long64_t firstEntry, FillProgress *progress, bool finalise,
+                      Long64_t lastEntry, std::atomic<Long64_t> *entriesRead, const ColumnSet *columns) {
+  EventLoop loop(tree, branchNames, accumulators, conditions, out, columns);
+  if (!loop.IsValid()) return false;
+  loop.Fill(firstEntry, lastEntry, progress, entriesRead);
+  for (size_t i=0; finalise && i<accumulators.size(); ++i) accumulators[i]->Finalise();
+  return true;
+}
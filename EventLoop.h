@@ -0,0 +1,106 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+// Standard Library
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BranchAccumulator.h"
+#include "FillKernels.h"
+
+class ColumnSet;
+class FormulaSet;
+class TTree;
+
+
+// Events filled into one branch accumulator: a selection and a weight, both
+// TTree formulas (a branch name or any expression), empty for all events
+// and unit weights
+struct FillCondition {
+  std::string selection;
+  std::string weight;
+
+  FillCondition() {}
+  FillCondition(const std::string& eventSelection, const std::string& eventWeight)
+    : selection(eventSelection), weight(eventWeight) {}
+};
+
+
+// Periodic hook of the event loop, e.g. to checkpoint the accumulators
+class FillProgress {
+public:
+  explicit FillProgress(double intervalSeconds);
+  virtual ~FillProgress() {}
+
+  // True once every interval
+  bool Due();
+
+  // All entries before nextEntry are in the accumulators (staged values included)
+  virtual void Checkpoint(Long64_t nextEntry) = 0;
+
+private:
+  std::chrono::duration<double> interval;
+  std::chrono::steady_clock::time_point last;
+};
+
+
+// Selections, weights and fill kernels of a group of branches, compiled once
+// for a tree and used for any number of entry ranges. Every distinct selection
+// and weight expression is evaluated once per event, shared by all branches
+// using it; plain branch names are read directly, without a TTreeFormula, and
+// from the optional column set where it has their column. Expressions and
+// branches that cannot be read are reported on out.
+class EventLoop {
+public:
+  EventLoop(TTree *tree, const std::vector<std::string>& branchNames,
+            const std::vector<BranchAccumulator*>& accumulators,
+            const std::vector<FillCondition>& conditions, std::ostream& out, const ColumnSet *columns = 0);
+  ~EventLoop();
+
+  // False if an expression cannot be compiled for this tree
+  bool IsValid() const { return valid; }
+
+  // Later ranges fill these accumulators, binned as the ones given before
+  void SetAccumulators(const std::vector<BranchAccumulator*>& accumulators);
+
+  // Fill entries from firstEntry up to lastEntry, or the end of the tree for
+  // a negative lastEntry, calling the optional progress hook when due
+  void Fill(Long64_t firstEntry, Long64_t lastEntry, FillProgress *progress = 0,
+            std::atomic<Long64_t> *entriesRead = 0);
+
+private:
+  EventLoop(const EventLoop&);
+  EventLoop& operator=(const EventLoop&);
+
+  TTree *tree;
+  FormulaSet *formulas;
+  std::vector<int> selections;
+  std::vector<int> weights;
+  std::vector<BranchFiller*> fillers;
+  int treeNumber; // tree of a chain the fillers are attached to
+  double treeWeight;
+  bool valid;
+};
+
+
+// Fill the accumulators of all given branches in a single pass over the tree,
+// each through the fill kernel matching its leaf type, and finalise them.
+// The loop starts at firstEntry, to resume an interrupted pass, and calls the
+// optional progress hook when due. Partial results to be merged later are
+// left unfinalised, and a non-negative lastEntry ends the loop before it.
+// The entries read are added to the optional entriesRead every few thousand
+// entries, for a progress report from another thread. Branches and plain
+// conditions with a column in the optional column set are read from it.
+// Returns false if an expression cannot be compiled for this tree, with the
+// error on out.
+bool FillAccumulators(TTree *tree, const std::vector<std::string>& branchNames,
+                      const std::vector<BranchAccumulator*>& accumulators,
+                      const std::vector<FillCondition>& conditions, std::ostream& out,
+                      Long64_t firstEntry = 0, FillProgress *progress = 0, bool finalise = true,
+                      Long64_t lastEntry = -1, std::atomic<Long64_t> *entriesRead = 0,
+                      const ColumnSet *columns = 0);
+
+#endif
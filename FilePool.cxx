@@ -0,0 +1,96 @@
+// Standard Library
+#include <sys/stat.h>
+
+#include "FilePool.h"
+
+// ROOT includes
+#include "TFile.h"
+
+
+FilePool::FilePool(size_t maxIdlePerFile) : maxIdle(maxIdlePerFile), reused(0), opened(0) {
+}
+
+
+FilePool::~FilePool() {
+  for (std::map<std::string, std::vector<std::pair<TFile*, Stamp> > >::iterator it=idle.begin(); it!=idle.end(); ++it) {
+    for (size_t i=0; i<it->second.size(); ++i) {
+      it->second[i].first->Close();
+      delete it->second[i].first;
+    }
+  }
+}
+
+
+bool FilePool::GetStamp(const std::string& fileName, Stamp& stamp) {
+  struct stat status;
+  if (stat(fileName.c_str(), &status) != 0) return false;
+  stamp.inode = status.st_ino;
+  stamp.size = status.st_size;
+  stamp.modified = status.st_mtime;
+  return true;
+}
+
+
+TFile* FilePool::Open(const std::string& fileName) {
+  Stamp stamp = Stamp();
+  bool exists = GetStamp(fileName, stamp);
+  TFile *file = 0;
+  std::vector<TFile*> stale;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++opened;
+    std::vector<std::pair<TFile*, Stamp> >& handles = idle[fileName];
+    while (!handles.empty() && !file) {
+      if (exists && handles.back().second == stamp) {
+        file = handles.back().first;
+        ++reused;
+      }
+      else stale.push_back(handles.back().first); // rewritten since it was opened
+      handles.pop_back();
+    }
+  }
+  for (size_t i=0; i<stale.size(); ++i) {
+    stale[i]->Close();
+    delete stale[i];
+  }
+
+  if (!file) file = new TFile(fileName.c_str());
+  std::lock_guard<std::mutex> lock(mutex);
+  Handle handle;
+  handle.fileName = fileName;
+  handle.stamp = stamp;
+  inUse[file] = handle;
+  return file;
+}
+
+
+TFile* OpenFile(const std::string& fileName, FilePool *files) {
+  if (files) return files->Open(fileName);
+  return new TFile(fileName.c_str());
+}
+
+
+void CloseFile(TFile *file, FilePool *files) {
+  if (files) files->Release(file);
+  else {
+    file->Close();
+    delete file;
+  }
+}
+
+
+void FilePool::Release(TFile *file) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<TFile*, Handle>::iterator it = inUse.find(file);
+    if (it != inUse.end()) {
+      std::vector<std::pair<TFile*, Stamp> >& handles = idle[it->second.fileName];
+      bool keep = !file->IsZombie() && handles.size() < maxIdle;
+      if (keep) handles.push_back(std::make_pair(file, it->second.stamp));
+      inUse.erase(it);
+      if (keep) return;
+    }
+  }
+  file->Close();
+  delete file;
+}
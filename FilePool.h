@@ -0,0 +1,67 @@
+#ifndef FILEPOOL_H
+#define FILEPOOL_H
+
+// Standard Library
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TFile;
+
+
+// ROOT files kept open across the runs of a daemon, so that later runs skip
+// opening them and reading their headers and streamer information again.
+// A handle is used by one thread at a time: Open hands out an idle handle of
+// the file, or a new one, and Release gives it back. Idle handles are only
+// reused while the file keeps its inode, size and modification time.
+class FilePool {
+public:
+  explicit FilePool(size_t maxIdlePerFile);
+  ~FilePool(); // closes the idle handles
+
+  // Handle for the caller alone; check IsZombie as for a new TFile
+  TFile* Open(const std::string& fileName);
+  void Release(TFile *file);
+
+  // Opens served by an idle handle, and all opens
+  size_t GetReused() const { return reused; }
+  size_t GetOpened() const { return opened; }
+
+private:
+  FilePool(const FilePool&);
+  FilePool& operator=(const FilePool&);
+
+  // Identity of the file on disk when its handle was opened
+  struct Stamp {
+    unsigned long long inode;
+    long long size;
+    long long modified;
+    bool operator==(const Stamp& other) const {
+      return inode == other.inode && size == other.size && modified == other.modified;
+    }
+  };
+  static bool GetStamp(const std::string& fileName, Stamp& stamp);
+
+  struct Handle {
+    std::string fileName;
+    Stamp stamp;
+  };
+
+  size_t maxIdle;
+  std::mutex mutex;
+  std::map<std::string, std::vector<std::pair<TFile*, Stamp> > > idle;
+  std::map<TFile*, Handle> inUse;
+  std::atomic<size_t> reused;
+  std::atomic<size_t> opened;
+};
+
+
+// Handle from the pool if given, otherwise a new TFile for the caller alone;
+// given back, or closed and deleted, by CloseFile with the same pool
+TFile* OpenFile(const std::string& fileName, FilePool *files);
+void CloseFile(TFile *file, FilePool *files);
+
+#endif
@@ -0,0 +1,132 @@
+// Microbenchmark of the accumulator fill kernels: values per second on one
+// core for TH1D::Fill, the scalar and the vectorised kernels, and a check of
+// the accumulator against the TH1D statistics of the same values.
+
+// Standard Library
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BranchAccumulator.h"
+#include "VectorKernels.h"
+
+// ROOT includes
+#include "TH1.h"
+
+
+namespace {
+  const int kBins = 100;
+  const double kLow = -10;
+  const double kHigh = 40; // no overflows, TH1 statistics skip them
+
+  double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void Report(const std::string& name, size_t nvalues, double seconds) {
+    std::cout<<"  "<<name<<": "<<nvalues/seconds/1e6<<" Mvalues/s per core"<<std::endl;
+  }
+
+  double KernelRate(const std::vector<double>& x, const std::vector<double>& w, int repeat) {
+    std::vector<double> contents(kBins+2, 0), sumw2(kBins+2, 0);
+    BlockMoments moments = {0, 0, 0, 0, 0, x[0], x[0]};
+    size_t blockSize = BranchAccumulator::kBlockSize;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r=0; r<repeat; ++r) {
+      for (size_t i=0; i<x.size(); i+=blockSize) {
+        size_t n = std::min(blockSize, x.size() - i);
+        BlockHistogramKernel(&x[i], &w[i], n, kBins, kLow, kHigh, &contents[0], &sumw2[0]);
+        BlockMomentsKernel(&x[i], &w[i], n, 0, moments);
+      }
+    }
+    return Seconds(start);
+  }
+
+  bool Agree(const std::string& what, double value, double expected, double tolerance) {
+    double scale = std::max(1.0, std::fabs(expected));
+    if (std::fabs(value - expected) <= tolerance*scale) return true;
+    std::cout<<"Error: "<<what<<" "<<value<<" differs from "<<expected<<std::endl;
+    return false;
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  size_t nvalues = (argc > 1) ? std::strtoul(argv[1], 0, 10) : 10000000;
+  int repeat = (argc > 2) ? std::atoi(argv[2]) : 5;
+  if (nvalues == 0 || repeat <= 0) {
+    std::cout<<"Usage: FillKernelBenchmark [number of values] [repetitions]"<<std::endl;
+    return 1;
+  }
+
+  // Skewed values well inside the range, with event weights
+  std::mt19937_64 generator(4357);
+  std::gamma_distribution<double> gamma(2.0, 1.0);
+  std::uniform_real_distribution<double> uniform(0.5, 1.5);
+  std::vector<double> x(nvalues), w(nvalues);
+  for (size_t i=0; i<nvalues; ++i) {
+    x[i] = gamma(generator) - 2.0;
+    w[i] = uniform(generator);
+  }
+
+  TH1::AddDirectory(kFALSE);
+  std::cout<<"Filling "<<nvalues<<" values "<<repeat<<" times, "<<kBins<<" bins"<<std::endl;
+
+  TH1D timing("timing", "", kBins, kLow, kHigh);
+  timing.Sumw2();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int r=0; r<repeat; ++r) {
+    for (size_t i=0; i<nvalues; ++i) timing.Fill(x[i], w[i]);
+  }
+  Report("TH1D::Fill", nvalues*repeat, Seconds(start));
+
+  UseVectorKernels(false);
+  Report("scalar kernels", nvalues*repeat, KernelRate(x, w, repeat));
+  if (UseVectorKernels(true)) {
+    Report(std::string(VectorKernelsName())+" kernels", nvalues*repeat, KernelRate(x, w, repeat));
+  }
+  else std::cout<<"  no vectorised kernels on this CPU"<<std::endl;
+
+  // One pass through the accumulator, as the event loop does
+  TH1D reference("reference", "", kBins, kLow, kHigh);
+  reference.Sumw2();
+  for (size_t i=0; i<nvalues; ++i) reference.Fill(x[i], w[i]);
+  BranchAccumulator acc("accumulator", kBins, kLow, kHigh);
+  start = std::chrono::steady_clock::now();
+  for (size_t i=0; i<nvalues; ++i) acc.Fill(x[i], w[i]);
+  acc.Finalise();
+  Report("BranchAccumulator::Fill", nvalues, Seconds(start));
+
+  // Identical bins, moments equal up to the summation order
+  bool ok = true;
+  TH1 *hist = acc.GetHistogram();
+  for (int bin=0; bin<=kBins+1 && ok; ++bin) {
+    ok = Agree("bin content", hist->GetBinContent(bin), reference.GetBinContent(bin), 0) &&
+         Agree("bin error", hist->GetBinError(bin), reference.GetBinError(bin), 1e-12);
+  }
+  ok = ok && Agree("entries", hist->GetEntries(), reference.GetEntries(), 0);
+  ok = ok && Agree("sum of weights", acc.GetSumOfWeights(), reference.GetSumOfWeights(), 1e-9);
+  ok = ok && Agree("effective entries", acc.GetEffectiveEntries(), reference.GetEffectiveEntries(), 1e-9);
+  ok = ok && Agree("mean", acc.GetMean(), reference.GetMean(), 1e-9);
+  ok = ok && Agree("standard deviation", acc.GetStdDev(), reference.GetStdDev(), 1e-9);
+
+  // TH1 skewness comes from the bin centres, compare with a two-pass sum
+  long double sum = 0, sumw = 0, m2 = 0, m3 = 0;
+  for (size_t i=0; i<nvalues; ++i) { sum += w[i]*x[i]; sumw += w[i]; }
+  long double mean = sum/sumw;
+  for (size_t i=0; i<nvalues; ++i) {
+    long double d = x[i] - mean;
+    m2 += w[i]*d*d;
+    m3 += w[i]*d*d*d;
+  }
+  double skewness = (double) ((m3/sumw)/std::pow((double) (m2/sumw), 1.5));
+  ok = ok && Agree("skewness", acc.GetSkewness(), skewness, 1e-9);
+
+  std::cout<<(ok ? "Accumulator agrees with TH1D" : "Accumulator check FAILED")<<std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+// Standard Library
+#include <cstring>
+#include <iostream>
+
+#include "FillKernels.h"
+
+// ROOT includes
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TTreeFormula.h"
+
+
+template <typename T>
+LeafFiller<T>::LeafFiller(TTree *tree, const std::string& branchName, BranchAccumulator *accumulator)
+  : BranchFiller(accumulator), name(branchName), branch(0), leaf(0) {
+  Notify(tree);
+}
+
+
+template <typename T>
+void LeafFiller<T>::Fill(Long64_t localEntry, double weight) {
+  branch->GetEntry(localEntry);
+  const T *values = (const T*) leaf->GetValuePointer();
+  int ndata = leaf->GetLen(); // reads the leaf count of variable size arrays
+  for (int j=0; j<ndata; ++j) {
+    acc->Fill((double) values[j], weight);
+  }
+}
+
+
+template <typename T>
+void LeafFiller<T>::Notify(TTree *current) {
+  branch = current->GetBranch(name.c_str());
+  leaf = (TLeaf*) branch->GetListOfLeaves()->At(0);
+}
+
+
+template <typename T>
+LeafReader<T>::LeafReader(TTree *tree, const std::string& branchName)
+  : name(branchName), branch(0), leaf(0) {
+  Notify(tree);
+}
+
+
+template <typename T>
+double LeafReader<T>::Read(Long64_t localEntry) {
+  branch->GetEntry(localEntry);
+  return (leaf->GetLen() > 0) ? (double) *(const T*) leaf->GetValuePointer() : 0;
+}
+
+
+template <typename T>
+void LeafReader<T>::Notify(TTree *current) {
+  branch = current->GetBranch(name.c_str());
+  leaf = (TLeaf*) branch->GetListOfLeaves()->At(0);
+}
+
+
+namespace {
+  // Fallback for branches TTree::Draw understands but the typed kernels do not
+  class FormulaFiller : public BranchFiller {
+  public:
+    FormulaFiller(TTreeFormula *var, BranchAccumulator *accumulator) : BranchFiller(accumulator), formula(var) {}
+    virtual ~FormulaFiller() { delete formula; }
+
+    virtual void Fill(Long64_t, double weight) {
+      int ndata = formula->GetNdata();
+      for (int j=0; j<ndata; ++j) {
+        acc->Fill(formula->EvalInstance(j), weight);
+      }
+    }
+
+    virtual void Notify(TTree *) { formula->UpdateFormulaLeaves(); }
+
+  private:
+    TTreeFormula *formula;
+  };
+
+  template <typename T>
+  BranchFiller* MakeLeafFiller(TTree *tree, const std::string& branchName, BranchAccumulator *accumulator, bool exact) {
+    if (exact) accumulator->EnableExactCounting();
+    return new LeafFiller<T>(tree, branchName, accumulator);
+  }
+
+  template <typename T>
+  ValueReader* MakeLeafReader(TTree *tree, const std::string& branchName) {
+    return new LeafReader<T>(tree, branchName);
+  }
+
+  typedef BranchFiller* (*FillerFactory)(TTree*, const std::string&, BranchAccumulator*, bool);
+  typedef ValueReader* (*ReaderFactory)(TTree*, const std::string&);
+
+  struct LeafKernel {
+    const char *typeName;
+    FillerFactory factory;
+    ReaderFactory readerFactory;
+    bool exact; // integer values are counted exactly
+  };
+
+  // In-memory leaf types; Float16_t and Double32_t are only packed on disk
+  const LeafKernel kLeafKernels[] = {
+    {"Double_t", &MakeLeafFiller<Double_t>, &MakeLeafReader<Double_t>, false},
+    {"Double32_t", &MakeLeafFiller<Double_t>, &MakeLeafReader<Double_t>, false},
+    {"Float_t", &MakeLeafFiller<Float_t>, &MakeLeafReader<Float_t>, false},
+    {"Float16_t", &MakeLeafFiller<Float_t>, &MakeLeafReader<Float_t>, false},
+    {"Int_t", &MakeLeafFiller<Int_t>, &MakeLeafReader<Int_t>, true},
+    {"UInt_t", &MakeLeafFiller<UInt_t>, &MakeLeafReader<UInt_t>, true},
+    {"Short_t", &MakeLeafFiller<Short_t>, &MakeLeafReader<Short_t>, true},
+    {"UShort_t", &MakeLeafFiller<UShort_t>, &MakeLeafReader<UShort_t>, true},
+    {"Char_t", &MakeLeafFiller<Char_t>, &MakeLeafReader<Char_t>, true},
+    {"UChar_t", &MakeLeafFiller<UChar_t>, &MakeLeafReader<UChar_t>, true},
+    {"Long64_t", &MakeLeafFiller<Long64_t>, &MakeLeafReader<Long64_t>, true},
+    {"ULong64_t", &MakeLeafFiller<ULong64_t>, &MakeLeafReader<ULong64_t>, true},
+    {"Bool_t", &MakeLeafFiller<Bool_t>, &MakeLeafReader<Bool_t>, true}
+  };
+}
+
+
+namespace {
+  // Kernel of a plain branch with one leaf of fundamental type, null for anything else
+  const LeafKernel* FindLeafKernel(TTree *tree, const std::string& branchName) {
+    TBranch *branch = tree->GetBranch(branchName.c_str());
+    if (!branch || std::strcmp(branch->ClassName(), "TBranch") != 0 || branch->GetListOfLeaves()->GetEntriesFast() != 1) return 0;
+    TLeaf *leaf = (TLeaf*) branch->GetListOfLeaves()->At(0);
+    if (std::strcmp(leaf->ClassName(), "TLeafC") == 0) return 0; // strings
+    for (size_t k=0; k<sizeof(kLeafKernels)/sizeof(LeafKernel); ++k) {
+      if (std::strcmp(leaf->GetTypeName(), kLeafKernels[k].typeName) == 0) return &kLeafKernels[k];
+    }
+    return 0;
+  }
+}
+
+
+BranchFiller* CreateBranchFiller(TTree *tree, const std::string& branchName, BranchAccumulator *accumulator) {
+  // Plain branches with one leaf of fundamental type get a typed kernel
+  const LeafKernel *kernel = FindLeafKernel(tree, branchName);
+  if (kernel) return kernel->factory(tree, branchName, accumulator, kernel->exact);
+
+  // Anything else is evaluated as TTree::Draw would
+  TTreeFormula *formula = new TTreeFormula(("var_"+branchName).c_str(), branchName.c_str(), tree);
+  if (formula->GetNdim() == 0) {
+    delete formula;
+    return 0;
+  }
+  return new FormulaFiller(formula, accumulator);
+}
+
+
+ValueReader* CreateValueReader(TTree *tree, const std::string& branchName) {
+  const LeafKernel *kernel = FindLeafKernel(tree, branchName);
+  return kernel ? kernel->readerFactory(tree, branchName) : 0;
+}
+
+
+bool IsPlainLeafBranch(TTree *tree, const std::string& branchName, bool& exact) {
+  const LeafKernel *kernel = FindLeafKernel(tree, branchName);
+  exact = kernel && kernel->exact;
+  return kernel != 0;
+}
+
+
+// Kernels available to other translation units
+template class LeafFiller<Double_t>;
+template class LeafFiller<Float_t>;
+template class LeafFiller<Int_t>;
+template class LeafFiller<UInt_t>;
+template class LeafFiller<Short_t>;
+template class LeafFiller<UShort_t>;
+template class LeafFiller<Char_t>;
+template class LeafFiller<UChar_t>;
+template class LeafFiller<Long64_t>;
+template class LeafFiller<ULong64_t>;
+template class LeafFiller<Bool_t>;
+template class LeafReader<Double_t>;
+template class LeafReader<Float_t>;
+template class LeafReader<Int_t>;
+template class LeafReader<UInt_t>;
+template class LeafReader<Short_t>;
+template class LeafReader<UShort_t>;
+template class LeafReader<Char_t>;
+template class LeafReader<UChar_t>;
+template class LeafReader<Long64_t>;
+template class LeafReader<ULong64_t>;
+template class LeafReader<Bool_t>;
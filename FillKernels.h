@@ -0,0 +1,95 @@
+#ifndef FILLKERNELS_H
+#define FILLKERNELS_H
+
+// Standard Library
+#include <string>
+
+#include "BranchAccumulator.h"
+
+class TTree;
+class TBranch;
+class TLeaf;
+
+
+// Reads one branch per entry and fills all its values into the accumulator.
+// The concrete kernel is chosen once per branch from the type of its leaf.
+class BranchFiller {
+public:
+  explicit BranchFiller(BranchAccumulator *accumulator) : acc(accumulator) {}
+  virtual ~BranchFiller() {}
+
+  // Load the branch at the entry of the current tree and fill its values
+  virtual void Fill(Long64_t localEntry, double weight) = 0;
+
+  // Chains: re-attach to the tree that was just loaded
+  virtual void Notify(TTree *current) = 0;
+
+  // Fill another accumulator of the same binning from now on
+  void SetAccumulator(BranchAccumulator *accumulator) { acc = accumulator; }
+
+protected:
+  BranchAccumulator *acc;
+};
+
+
+// Typed kernel for a branch with a single leaf of fundamental type T.
+// Values are read straight from the leaf buffer, without TTreeFormula
+// or the virtual TLeaf::GetValue conversion.
+template <typename T>
+class LeafFiller : public BranchFiller {
+public:
+  LeafFiller(TTree *tree, const std::string& branchName, BranchAccumulator *accumulator);
+  virtual void Fill(Long64_t localEntry, double weight);
+  virtual void Notify(TTree *current);
+
+private:
+  std::string name;
+  TBranch *branch;
+  TLeaf *leaf;
+};
+
+
+// Reads the first value of a plain numeric branch per entry, for selections
+// and weights that are a branch name. As fast as the typed fill kernels and
+// without compiling a TTreeFormula.
+class ValueReader {
+public:
+  virtual ~ValueReader() {}
+
+  // Value of the entry of the current tree, 0 for an empty array
+  virtual double Read(Long64_t localEntry) = 0;
+
+  // Chains: re-attach to the tree that was just loaded
+  virtual void Notify(TTree *current) = 0;
+};
+
+
+template <typename T>
+class LeafReader : public ValueReader {
+public:
+  LeafReader(TTree *tree, const std::string& branchName);
+  virtual double Read(Long64_t localEntry);
+  virtual void Notify(TTree *current);
+
+private:
+  std::string name;
+  TBranch *branch;
+  TLeaf *leaf;
+};
+
+
+// Create the kernel for a branch: exact counting for integer and boolean
+// leaves, direct reads for floating point leaves, and the TTreeFormula
+// evaluation TTree::Draw would use for anything else. Returns null if the
+// branch cannot be histogrammed.
+BranchFiller* CreateBranchFiller(TTree *tree, const std::string& branchName, BranchAccumulator *accumulator);
+
+// Create the reader of a plain branch with one leaf of fundamental type,
+// null for any other branch or expression
+ValueReader* CreateValueReader(TTree *tree, const std::string& branchName);
+
+// Whether the branch is a plain branch with one leaf of fundamental type, as
+// read by the typed kernels; exact for the integer types counted exactly
+bool IsPlainLeafBranch(TTree *tree, const std::string& branchName, bool& exact);
+
+#endif
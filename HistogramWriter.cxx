@@ -0,0 +1,157 @@
+// Standard Library
+#include <algorithm>
+#include <cmath>
+
+#include "HistogramWriter.h"
+
+// ROOT includes
+#include "TFile.h"
+#include "TH1.h"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TCanvas.h"
+#include "TLegend.h"
+
+
+HistogramWriter::HistogramWriter(const std::string& fileName, const std::string& plotDirectory, std::ostream& log)
+  : file(0), plots(plotDirectory), out(log), closing(false) {
+  // The comparisons keep using ROOT while the writer thread writes
+  ROOT::EnableThreadSafety();
+  if (!plots.empty()) {
+    gROOT->SetBatch(kTRUE);
+    gSystem->mkdir(plots.c_str(), kTRUE);
+  }
+
+  TDirectory::TContext context; // histograms created later stay out of this file
+  file = new TFile(fileName.c_str(), "RECREATE");
+  if (file->IsZombie()) {
+    out<<"Error: output file "<<fileName<<" cannot be created"<<std::endl;
+    delete file;
+    file = 0;
+    return;
+  }
+  writer = std::thread(&HistogramWriter::Run, this);
+}
+
+
+HistogramWriter::~HistogramWriter() {
+  Close();
+}
+
+
+void HistogramWriter::Add(const std::string& branchName, const TH1 *h, const TH1 *href, double scale, bool pass) {
+  if (!file) return;
+  SavedComparison comparison;
+  comparison.branch = branchName;
+  comparison.input = (TH1*) h->Clone("input");
+  comparison.input->SetDirectory(0);
+  comparison.reference = (TH1*) href->Clone("reference");
+  comparison.reference->SetDirectory(0);
+  comparison.reference->Scale(scale);
+  comparison.pass = pass;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  written.wait(lock, [this] { return pending.size() < kMaxQueued; });
+  pending.push_back(comparison);
+  if (pending.size() >= kBatchSize) queued.notify_one();
+}
+
+
+void HistogramWriter::Close() {
+  if (!file) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  queued.notify_one();
+  writer.join();
+  file->Close();
+  delete file;
+  file = 0;
+  for (size_t i=0; i<unsaved.size(); ++i) {
+    out<<"WARNING: histograms of "<<unsaved[i]<<" cannot be saved"<<std::endl;
+  }
+}
+
+
+void HistogramWriter::Run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    queued.wait(lock, [this] { return closing || pending.size() >= kBatchSize; });
+    if (pending.empty()) break; // closing
+    std::vector<SavedComparison> batch;
+    batch.swap(pending);
+    lock.unlock();
+    written.notify_all();
+    WriteBatch(batch);
+    lock.lock();
+  }
+}
+
+
+void HistogramWriter::WriteBatch(const std::vector<SavedComparison>& batch) {
+  std::vector<TH1*> objects;
+  for (size_t i=0; i<batch.size(); ++i) {
+    const SavedComparison& comparison = batch[i];
+    TDirectory *dir = file->GetDirectory(comparison.branch.c_str());
+    if (!dir) dir = file->mkdir(comparison.branch.c_str());
+    if (!dir) {
+      unsaved.push_back(comparison.branch); // reported by Close
+      delete comparison.input;
+      delete comparison.reference;
+      continue;
+    }
+
+    TH1 *ratio = (TH1*) comparison.input->Clone("ratio");
+    ratio->Divide(comparison.reference);
+
+    // Bin-by-bin pulls, (input - reference)/sigma
+    TH1 *pull = (TH1*) comparison.input->Clone("pull");
+    pull->Reset();
+    for (int bin=0; bin<pull->GetNcells(); ++bin) {
+      double d = comparison.input->GetBinContent(bin) - comparison.reference->GetBinContent(bin);
+      double e1 = comparison.input->GetBinError(bin);
+      double e2 = comparison.reference->GetBinError(bin);
+      double sigma = std::sqrt(e1*e1 + e2*e2);
+      pull->SetBinContent(bin, (sigma > 0) ? d/sigma : 0);
+    }
+    pull->ResetStats();
+
+    if (!plots.empty() && comparison.input->GetDimension() == 1) SavePlot(comparison);
+
+    TH1 *histograms[] = {comparison.input, comparison.reference, ratio, pull};
+    for (int k=0; k<4; ++k) {
+      histograms[k]->SetTitle(comparison.branch.c_str());
+      histograms[k]->SetDirectory(dir);
+      objects.push_back(histograms[k]);
+    }
+  }
+
+  // One write for the whole batch, then the copies are released
+  file->Write();
+  for (size_t i=0; i<objects.size(); ++i) delete objects[i];
+}
+
+
+void HistogramWriter::SavePlot(const SavedComparison& comparison) {
+  std::string name = comparison.branch;
+  for (size_t i=0; i<name.size(); ++i) {
+    if (name[i] == '/') name[i] = '_';
+  }
+  TCanvas canvas(("c_"+name).c_str(), comparison.branch.c_str(), 800, 600);
+  comparison.input->SetTitle((comparison.branch + (comparison.pass ? "" : " (failed)")).c_str());
+  comparison.input->SetStats(kFALSE);
+  comparison.input->SetLineColor(kBlue);
+  comparison.reference->SetLineColor(kRed);
+  comparison.reference->SetMarkerColor(kRed);
+  comparison.reference->SetMarkerStyle(20);
+  comparison.input->SetMaximum(1.1*std::max(comparison.input->GetMaximum(), comparison.reference->GetMaximum()));
+  comparison.input->Draw("hist");
+  comparison.reference->Draw("e same");
+  TLegend legend(0.7, 0.8, 0.9, 0.9);
+  legend.AddEntry(comparison.input, "input", "l");
+  legend.AddEntry(comparison.reference, "reference", "lep");
+  legend.Draw();
+  canvas.SaveAs((plots + "/" + name + ".png").c_str());
+  comparison.input->SetMaximum();
+}
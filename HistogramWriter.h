@@ -0,0 +1,66 @@
+#ifndef HISTOGRAMWRITER_H
+#define HISTOGRAMWRITER_H
+
+// Standard Library
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TFile;
+class TH1;
+
+
+// Output file of the compared histograms, one directory per branch with
+// the input, the reference normalised to the input, their ratio and the
+// per-bin pulls; optionally a PNG overlay per branch. Comparisons hand over
+// copies and continue, a writer thread persists them in batches. Errors are
+// reported on out, those of the writer thread once it is closed.
+class HistogramWriter {
+public:
+  HistogramWriter(const std::string& fileName, const std::string& plotDirectory, std::ostream& log);
+  ~HistogramWriter(); // closes the file
+
+  bool IsOpen() const { return file != 0; }
+
+  // Queue copies of the histograms of one branch; thread safe
+  void Add(const std::string& branchName, const TH1 *h, const TH1 *href, double scale, bool pass);
+
+  // Write what is queued and close the file
+  void Close();
+
+  // Comparisons written per TFile::Write and the most queued before Add waits
+  static const size_t kBatchSize = 64;
+  static const size_t kMaxQueued = 1024;
+
+private:
+  HistogramWriter(const HistogramWriter&);
+  HistogramWriter& operator=(const HistogramWriter&);
+
+  struct SavedComparison {
+    std::string branch;
+    TH1 *input;
+    TH1 *reference; // scaled to the input
+    bool pass;
+  };
+
+  void Run();
+  void WriteBatch(const std::vector<SavedComparison>& batch);
+  void SavePlot(const SavedComparison& comparison);
+
+  TFile *file;
+  std::string plots;
+  std::ostream& out;
+  std::vector<std::string> unsaved; // branches the writer thread could not save
+
+  std::mutex mutex;
+  std::condition_variable queued;
+  std::condition_variable written;
+  std::vector<SavedComparison> pending;
+  bool closing;
+  std::thread writer;
+};
+
+#endif
@@ -0,0 +1,111 @@
+// Standard Library
+#include <algorithm>
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "MemoryPlan.h"
+#include "BranchAccumulator.h"
+
+// ROOT includes
+#include "TBranch.h"
+
+
+namespace {
+  // TH1D object, axes and names, besides the bin arrays
+  const double kHistogramOverhead = 2048;
+
+  double BasketMemory(TBranch *branch) {
+    if (!branch) return 0;
+    // Compressed and uncompressed buffer of the basket being read
+    double bytes = 2.0*branch->GetBasketSize();
+    TObjArray *subbranches = branch->GetListOfBranches();
+    for (int i=0; subbranches && i<subbranches->GetEntriesFast(); ++i) {
+      bytes += BasketMemory((TBranch*) subbranches->At(i));
+    }
+    return bytes;
+  }
+
+  struct LargerBranch {
+    const std::vector<double>& bytes;
+    explicit LargerBranch(const std::vector<double>& branchBytes) : bytes(branchBytes) {}
+    bool operator()(size_t a, size_t b) const { return bytes[a] > bytes[b]; }
+  };
+
+  bool FirstBranchBefore(const std::vector<size_t>& a, const std::vector<size_t>& b) {
+    return a.front() < b.front();
+  }
+}
+
+
+double EstimateBranchMemory(TBranch *branch, TBranch *refBranch, int nbins) {
+  double accumulator = sizeof(BranchAccumulator) + kHistogramOverhead
+    + 2.0*(nbins + 2)*sizeof(double) // contents and sum of squared weights
+    + 2.0*BranchAccumulator::kBlockSize*sizeof(double)
+    + 2.0*BranchAccumulator::kMaxExactValues*sizeof(double);
+  return 2*accumulator + BasketMemory(branch) + BasketMemory(refBranch);
+}
+
+
+std::vector<std::vector<size_t> > PlanBranchGroups(const std::vector<double>& branchBytes, double budget) {
+  std::vector<size_t> order(branchBytes.size());
+  for (size_t i=0; i<order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), LargerBranch(branchBytes));
+
+  // First fit decreasing
+  std::vector<std::vector<size_t> > groups;
+  std::vector<double> used;
+  for (size_t k=0; k<order.size(); ++k) {
+    size_t i = order[k];
+    size_t g = 0;
+    while (g < groups.size() && used[g] + branchBytes[i] > budget) ++g;
+    if (g == groups.size()) {
+      groups.push_back(std::vector<size_t>());
+      used.push_back(0);
+    }
+    groups[g].push_back(i);
+    used[g] += branchBytes[i];
+  }
+
+  for (size_t g=0; g<groups.size(); ++g) std::sort(groups[g].begin(), groups[g].end());
+  std::sort(groups.begin(), groups.end(), FirstBranchBefore);
+  return groups;
+}
+
+
+void PrintMemoryPlan(const std::string& treeName, const std::vector<std::vector<size_t> >& groups,
+                     const std::vector<double>& branchBytes, double budget, std::ostream& out) {
+  const double MB = 1024*1024;
+  double total = 0;
+  for (size_t i=0; i<branchBytes.size(); ++i) total += branchBytes[i];
+  out<<"Memory plan for tree "<<treeName<<": "<<branchBytes.size()<<" branches, estimated "<<total/MB
+     <<" MB, in "<<groups.size()<<" pass(es) of at most "<<budget/MB<<" MB"<<std::endl;
+  for (size_t g=0; g<groups.size(); ++g) {
+    double bytes = 0;
+    for (size_t k=0; k<groups[g].size(); ++k) bytes += branchBytes[groups[g][k]];
+    out<<"  pass "<<g+1<<": "<<groups[g].size()<<" branches, "<<bytes/MB<<" MB"<<std::endl;
+    if (bytes > budget) {
+      out<<"WARNING: branch group of pass "<<g+1<<" alone exceeds the memory budget"<<std::endl;
+    }
+  }
+}
+
+
+double CurrentResidentMemory() {
+  // Resident pages are the second field of statm (Linux)
+  std::ifstream statm("/proc/self/statm");
+  double size = 0, resident = 0;
+  if (statm >> size >> resident) return resident*sysconf(_SC_PAGESIZE);
+  return PeakResidentMemory();
+}
+
+
+double PeakResidentMemory() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss; // bytes
+#else
+  return usage.ru_maxrss*1024.0; // kilobytes
+#endif
+}
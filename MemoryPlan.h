@@ -0,0 +1,31 @@
+#ifndef MEMORYPLAN_H
+#define MEMORYPLAN_H
+
+// Standard Library
+#include <ostream>
+#include <string>
+#include <vector>
+
+class TBranch;
+
+
+// Estimated memory needed to compare one branch: the input and reference
+// accumulators with their staged blocks and exact counts, and the basket
+// buffers of both branches and their sub-branches while they are read.
+// refBranch may be null if the reference tree lacks the branch.
+double EstimateBranchMemory(TBranch *branch, TBranch *refBranch, int nbins);
+
+// Split the branches into groups compared in separate passes, each within
+// budget bytes, in as few passes as first-fit decreasing packing finds.
+// Branch indices keep their order within a group, groups are ordered by
+// their first branch; a branch larger than the budget gets a pass of its own.
+std::vector<std::vector<size_t> > PlanBranchGroups(const std::vector<double>& branchBytes, double budget);
+
+void PrintMemoryPlan(const std::string& treeName, const std::vector<std::vector<size_t> >& groups,
+                     const std::vector<double>& branchBytes, double budget, std::ostream& out);
+
+// Resident memory of the process now and at its peak, in bytes
+double CurrentResidentMemory();
+double PeakResidentMemory();
+
+#endif
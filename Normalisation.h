@@ -0,0 +1,42 @@
+#ifndef NORMALISATION_H
+#define NORMALISATION_H
+
+#include "BranchAccumulator.h"
+
+class TTree;
+
+
+// Sample sizes of one input/reference comparison. The tree entry counts are
+// looked up once per tree pair; the histograms themselves keep raw counts so
+// the two-sample tests see the true sample sizes and errors.
+struct Normalisation {
+  Long64_t entries;
+  Long64_t refEntries;
+  bool weighted;
+
+  Normalisation(TTree *tree, TTree *reftree, bool isWeighted);
+  Normalisation(Long64_t nentries, Long64_t nrefEntries, bool isWeighted);
+
+  // Factor bringing a reference quantity to the input normalisation,
+  // for display and for tests on absolute bin contents only
+  double ReferenceScale(const BranchAccumulator& acc, const BranchAccumulator& refacc) const;
+
+  // Two-sample Kolmogorov-Smirnov p-value on the raw histograms
+  double KolmogorovTest(const TH1 *h, const TH1 *href) const;
+
+  // Two-sample Chi2 p-value, "UU" for raw counts and "WW" for weighted fills
+  double Chi2Test(const TH1 *h, const TH1 *href) const;
+
+  // Wasserstein-1 (earth mover's) distance between the normalised input and
+  // reference distributions within the histogram range, in units of the
+  // variable; NaN for empty or multi-dimensional histograms
+  double WassersteinDistance(const TH1 *h, const TH1 *href) const;
+
+  // Two-sample Anderson-Darling p-value, more sensitive in the tails than the
+  // Kolmogorov-Smirnov test. The statistic of Scholz and Stephens for tied
+  // values is taken over all bins, under- and overflow included, weighted
+  // contents scaled to the effective entries; the p-value is asymptotic.
+  double AndersonDarlingTest(const BranchAccumulator& acc, const BranchAccumulator& refacc, double& statistic) const;
+};
+
+#endif
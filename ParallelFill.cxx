@@ -0,0 +1,234 @@
+// Standard Library
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include "ParallelFill.h"
+#include "ColumnCache.h"
+#include "FilePool.h"
+
+// ROOT includes
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TTree.h"
+#include "TTreeFormula.h"
+
+
+namespace {
+  // Ranges are a fraction of the tree per thread, so stealing can even out the load
+  const Long64_t kMinRangeEntries = 1000;
+  const int kRangesPerThread = 8;
+
+  // Partials of the entry ranges, merged into the accumulators in entry order
+  // as soon as all earlier ranges are in. The sums then never depend on which
+  // thread took which range, and only ranges done ahead of an earlier one wait.
+  class RangeMerger {
+  public:
+    RangeMerger(const std::vector<BranchAccumulator*>& totals, Long64_t firstEntry, std::ostream& log)
+      : accumulators(totals), nextEntry(firstEntry), out(log) {}
+
+    ~RangeMerger() { // partials left behind by a failed worker
+      for (std::map<Long64_t, Pending>::iterator it=pending.begin(); it!=pending.end(); ++it) Delete(it->second.partials);
+    }
+
+    // Empty partials binned as the accumulators
+    std::vector<BranchAccumulator*> Create() {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<BranchAccumulator*> partials;
+      for (size_t i=0; i<accumulators.size(); ++i) {
+        partials.push_back(new BranchAccumulator(accumulators[i]->GetHistogram()->GetName(), *accumulators[i]));
+      }
+      return partials;
+    }
+
+    // Takes the partials of a filled range
+    void Add(const EntryRange& range, const std::vector<BranchAccumulator*>& partials) {
+      std::lock_guard<std::mutex> lock(mutex);
+      Pending& filled = pending[range.first];
+      filled.last = range.last;
+      filled.partials = partials;
+      std::map<Long64_t, Pending>::iterator next;
+      while ( (next = pending.find(nextEntry)) != pending.end() ) {
+        for (size_t i=0; i<accumulators.size(); ++i) accumulators[i]->Merge(*next->second.partials[i], out);
+        Delete(next->second.partials);
+        nextEntry = next->second.last;
+        pending.erase(next);
+      }
+    }
+
+    static void Delete(const std::vector<BranchAccumulator*>& partials) {
+      for (size_t i=0; i<partials.size(); ++i) delete partials[i];
+    }
+
+  private:
+    struct Pending {
+      Long64_t last;
+      std::vector<BranchAccumulator*> partials;
+    };
+
+    std::mutex mutex;
+    std::vector<BranchAccumulator*> accumulators;
+    std::map<Long64_t, Pending> pending; // by first entry
+    Long64_t nextEntry; // first entry of the next range to merge
+    std::ostream& out; // written under the mutex
+  };
+
+  // Branches read by a selection or weight, unless mapped from a column
+  void AddConditionToCache(TTree *tree, const std::string& expression, const ColumnSet *columns) {
+    if (expression.empty() || (columns && columns->Has(expression))) return;
+    if (tree->GetBranch(expression.c_str())) {
+      tree->AddBranchToCache(expression.c_str(), kTRUE);
+      return;
+    }
+    TTreeFormula formula(("cache_"+expression).c_str(), expression.c_str(), tree);
+    for (int k=0; k<formula.GetNcodes(); ++k) {
+      TLeaf *leaf = formula.GetLeaf(k);
+      if (leaf) tree->AddBranchToCache(leaf->GetBranch(), kTRUE);
+    }
+  }
+
+  // Worker: own file handle, tree and event loop, compiled once for all its
+  // ranges; each range is filled into partials of its own
+  void FillRanges(std::string fileName, std::string treeName, const std::vector<std::string>& branchNames,
+                  const std::vector<FillCondition>& conditions, RangeScheduler& scheduler, int worker,
+                  RangeMerger& merger, Long64_t cacheSize, std::atomic<Long64_t> *entriesRead,
+                  const ColumnSet *columns, FilePool *files, char& filled) {
+    TFile *file = OpenFile(fileName, files);
+    TTree *tree = file->IsZombie() ? 0 : (TTree*) file->Get(treeName.c_str());
+    std::vector<BranchAccumulator*> partials = merger.Create();
+    EventLoop *loop = 0;
+    if (tree) {
+      tree->SetCacheSize(cacheSize);
+      for (size_t i=0; i<branchNames.size(); ++i) {
+        if (!columns || !columns->Has(branchNames[i])) tree->AddBranchToCache(branchNames[i].c_str(), kTRUE);
+        AddConditionToCache(tree, conditions[i].selection, columns);
+        AddConditionToCache(tree, conditions[i].weight, columns);
+      }
+      std::ostringstream reported; // as for the first range, already reported by the calling thread
+      loop = new EventLoop(tree, branchNames, partials, conditions, reported, columns);
+    }
+    filled = loop && loop->IsValid();
+    EntryRange range;
+    while (filled && scheduler.Next(worker, range)) {
+      if (partials.empty()) {
+        partials = merger.Create();
+        loop->SetAccumulators(partials);
+      }
+      loop->Fill(range.first, range.last, 0, entriesRead);
+      merger.Add(range, partials);
+      partials.clear();
+    }
+    RangeMerger::Delete(partials); // none taken
+    delete loop;
+    delete tree;
+    CloseFile(file, files);
+  }
+}
+
+
+std::vector<EntryRange> ClusterRanges(TTree *tree, Long64_t firstEntry, Long64_t rangeSize) {
+  std::vector<EntryRange> ranges;
+  Long64_t nentries = tree->GetEntries();
+  TTree::TClusterIterator clusters = tree->GetClusterIterator(firstEntry);
+  Long64_t clusterStart;
+  EntryRange range = {firstEntry, firstEntry};
+  while ( (clusterStart = clusters()) < nentries ) {
+    range.last = std::min(clusters.GetNextEntry(), nentries);
+    if (range.last - range.first >= rangeSize) {
+      ranges.push_back(range);
+      range.first = range.last;
+    }
+  }
+  if (range.last > range.first) ranges.push_back(range);
+  return ranges;
+}
+
+
+RangeScheduler::RangeScheduler(const std::vector<EntryRange>& ranges, int nworkers) : steals(0) {
+  for (int w=0; w<nworkers; ++w) queues.push_back(new Queue);
+  // Contiguous blocks keep each worker reading neighbouring clusters
+  for (size_t r=0; r<ranges.size(); ++r) {
+    queues[r*nworkers/ranges.size()]->ranges.push_back(ranges[r]);
+  }
+}
+
+
+RangeScheduler::~RangeScheduler() {
+  for (size_t w=0; w<queues.size(); ++w) delete queues[w];
+}
+
+
+bool RangeScheduler::Next(int worker, EntryRange& range) {
+  {
+    Queue& own = *queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.ranges.empty()) {
+      range = own.ranges.front();
+      own.ranges.pop_front();
+      return true;
+    }
+  }
+
+  // Idle: steal from the back of the longest queue until none is left
+  while (true) {
+    size_t victim = queues.size(), longest = 0;
+    for (size_t w=0; w<queues.size(); ++w) {
+      std::lock_guard<std::mutex> lock(queues[w]->mutex);
+      if (queues[w]->ranges.size() > longest) {
+        longest = queues[w]->ranges.size();
+        victim = w;
+      }
+    }
+    if (victim == queues.size()) return false;
+    std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+    if (queues[victim]->ranges.empty()) continue; // taken meanwhile, look again
+    range = queues[victim]->ranges.back();
+    queues[victim]->ranges.pop_back();
+    ++steals;
+    return true;
+  }
+}
+
+
+bool FillAccumulatorsInRanges(TTree *tree, const std::vector<std::string>& branchNames,
+                              const std::vector<BranchAccumulator*>& accumulators,
+                              const std::vector<FillCondition>& conditions,
+                              int nthreads, Long64_t cacheSize, std::ostream& out,
+                              std::atomic<Long64_t> *entriesRead, const ColumnSet *columns, FilePool *files) {
+  Long64_t rangeSize = std::max(kMinRangeEntries, tree->GetEntries()/(kRangesPerThread*nthreads));
+  std::vector<EntryRange> ranges = ClusterRanges(tree, 0, rangeSize);
+  TFile *file = tree->GetCurrentFile();
+  if (nthreads < 2 || ranges.size() < 2 || !file) {
+    return FillAccumulators(tree, branchNames, accumulators, conditions, out, 0, 0, true, -1, entriesRead, columns);
+  }
+
+  // The first range fixes automatic binnings before the partials copy them
+  if (!FillAccumulators(tree, branchNames, accumulators, conditions, out, ranges[0].first, 0, false, ranges[0].last, entriesRead, columns)) {
+    return false;
+  }
+  for (size_t i=0; i<accumulators.size(); ++i) accumulators[i]->FixBinning();
+  ranges.erase(ranges.begin());
+
+  int nworkers = std::min<int>(nthreads, ranges.size());
+  RangeScheduler scheduler(ranges, nworkers);
+  std::vector<char> filled(nworkers, 0);
+  bool ok = true;
+  {
+    RangeMerger merger(accumulators, ranges[0].first, out);
+    std::vector<std::thread> workers;
+    for (int w=0; w<nworkers; ++w) {
+      workers.push_back(std::thread(FillRanges, std::string(file->GetName()), std::string(tree->GetName()),
+                                    std::cref(branchNames), std::cref(conditions), std::ref(scheduler), w,
+                                    std::ref(merger), cacheSize, entriesRead, columns, files, std::ref(filled[w])));
+    }
+    for (int w=0; w<nworkers; ++w) {
+      workers[w].join();
+      ok = ok && filled[w];
+    }
+  }
+  for (size_t i=0; i<accumulators.size(); ++i) accumulators[i]->Finalise();
+  out<<"Tree "<<tree->GetName()<<" read in "<<ranges.size()+1<<" entry ranges by "<<nworkers<<" threads ("
+     <<scheduler.GetSteals()<<" ranges stolen)"<<std::endl;
+  return ok;
+}
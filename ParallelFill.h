@@ -0,0 +1,73 @@
+#ifndef PARALLELFILL_H
+#define PARALLELFILL_H
+
+// Standard Library
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BranchAccumulator.h"
+#include "EventLoop.h"
+
+class FilePool;
+class TTree;
+
+
+// Entries [first, last) of a tree
+struct EntryRange {
+  Long64_t first;
+  Long64_t last;
+};
+
+
+// Consecutive ranges from firstEntry to the end of the tree, of at least
+// rangeSize entries each, starting and ending on cluster boundaries so no
+// basket is read by two ranges
+std::vector<EntryRange> ClusterRanges(TTree *tree, Long64_t firstEntry, Long64_t rangeSize);
+
+
+// Work-stealing distribution of entry ranges over worker threads. Each worker
+// starts with a contiguous block of ranges and takes them from the front;
+// once its own are done it steals from the back of the longest other queue.
+class RangeScheduler {
+public:
+  RangeScheduler(const std::vector<EntryRange>& ranges, int nworkers);
+  ~RangeScheduler();
+
+  // Next range for the worker, false once all ranges are taken
+  bool Next(int worker, EntryRange& range);
+
+  int GetSteals() const { return steals; }
+
+private:
+  RangeScheduler(const RangeScheduler&);
+  RangeScheduler& operator=(const RangeScheduler&);
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<EntryRange> ranges;
+  };
+  std::vector<Queue*> queues;
+  std::atomic<int> steals;
+};
+
+
+// FillAccumulators over cluster-aligned entry ranges of the tree, filled by
+// up to nthreads threads with their own file handle and event loop. The first
+// range is filled by the calling thread, so automatic binnings are set from
+// the first entries as in a single pass; every other range is filled into
+// partial accumulators of its own, merged in entry order whichever thread took
+// it, so repeated runs give the same sums. All threads add to the optional
+// entriesRead counter and read the columns of the optional set; their file
+// handles come from the optional pool.
+bool FillAccumulatorsInRanges(TTree *tree, const std::vector<std::string>& branchNames,
+                              const std::vector<BranchAccumulator*>& accumulators,
+                              const std::vector<FillCondition>& conditions,
+                              int nthreads, Long64_t cacheSize, std::ostream& out,
+                              std::atomic<Long64_t> *entriesRead = 0, const ColumnSet *columns = 0,
+                              FilePool *files = 0);
+
+#endif
@@ -0,0 +1,292 @@
+// Standard Library
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "PartialResult.h"
+#include "BinaryIO.h"
+
+// ROOT includes
+#include "RZip.h"
+
+
+namespace {
+  const char kMagic[8] = {'S', 'V', 'T', 'P', 'A', 'R', 'T', '2'};
+
+  // Largest input of one R__zip call; bigger blocks are compressed in chunks
+  const size_t kMaxZipChunk = 0xffffff;
+  const int kCompressionLevel = 1;
+
+  // Compressed chunks, or the raw bytes if they do not compress
+  std::string Compress(const std::string& raw) {
+    std::string zipped;
+    std::vector<char> chunk;
+    for (size_t pos=0; pos<raw.size(); pos+=kMaxZipChunk) {
+      int srcSize = std::min(kMaxZipChunk, raw.size()-pos);
+      int tgtSize = srcSize;
+      int written = 0;
+      chunk.resize(tgtSize);
+      R__zip(kCompressionLevel, &srcSize, const_cast<char*>(raw.data()+pos), &tgtSize, &chunk[0], &written);
+      if (written <= 0) return raw;
+      zipped.append(&chunk[0], written);
+    }
+    return (zipped.size() < raw.size()) ? zipped : raw;
+  }
+
+  // Inverse of Compress; false for a corrupt block
+  bool Decompress(const unsigned char *stored, size_t storedSize, std::string& raw) {
+    if (storedSize == raw.size()) {
+      raw.assign((const char*) stored, storedSize);
+      return true;
+    }
+    size_t consumed = 0, produced = 0;
+    while (produced < raw.size()) {
+      int srcSize = 0, tgtSize = 0, unzipped = 0;
+      if (storedSize - consumed < 9) return false; // R__zip chunk header
+      if (R__unzip_header(&srcSize, const_cast<unsigned char*>(stored+consumed), &tgtSize) != 0) return false;
+      if (srcSize <= 0 || tgtSize <= 0 || (size_t) srcSize > storedSize-consumed || (size_t) tgtSize > raw.size()-produced) return false;
+      R__unzip(&srcSize, const_cast<unsigned char*>(stored+consumed), &tgtSize, (unsigned char*) &raw[produced], &unzipped);
+      if (unzipped != tgtSize) return false;
+      consumed += srcSize;
+      produced += tgtSize;
+    }
+    return consumed == storedSize;
+  }
+}
+
+
+PartialResult::PartialResult(Role sampleRole) : role(sampleRole) {
+}
+
+
+PartialResult::~PartialResult() {
+  for (size_t t=0; t<trees.size(); ++t) {
+    for (size_t i=0; i<trees[t].accumulators.size(); ++i) delete trees[t].accumulators[i];
+  }
+}
+
+
+void PartialResult::AddSource(const std::string& fileName) {
+  sources.push_back(fileName);
+}
+
+
+void PartialResult::AddTree(const std::string& treeName, Long64_t entries, const std::vector<std::string>& branchNames,
+                            const std::vector<BranchAccumulator*>& accumulators) {
+  PartialTree tree;
+  tree.name = treeName;
+  tree.entries = entries;
+  tree.branchNames = branchNames;
+  tree.accumulators = accumulators;
+  trees.push_back(tree);
+}
+
+
+void PartialResult::Merge(PartialResult *other, std::ostream& out) {
+  sources.insert(sources.end(), other->sources.begin(), other->sources.end());
+  for (size_t t=0; t<other->trees.size(); ++t) {
+    PartialTree& from = other->trees[t];
+    size_t k = 0;
+    while (k < trees.size() && trees[k].name != from.name) ++k;
+    if (k == trees.size()) { // new tree, its accumulators change hands
+      trees.push_back(from);
+      from.accumulators.clear();
+      continue;
+    }
+    PartialTree& into = trees[k];
+    into.entries += from.entries;
+    for (size_t i=0; i<from.branchNames.size(); ++i) {
+      size_t b = std::find(into.branchNames.begin(), into.branchNames.end(), from.branchNames[i]) - into.branchNames.begin();
+      if (b < into.branchNames.size()) {
+        into.accumulators[b]->Merge(*from.accumulators[i], out);
+        delete from.accumulators[i];
+      }
+      else {
+        into.branchNames.push_back(from.branchNames[i]);
+        into.accumulators.push_back(from.accumulators[i]);
+      }
+    }
+    from.accumulators.clear();
+  }
+  delete other;
+}
+
+
+const BranchAccumulator* PartialResult::Find(const std::string& treeName, const std::string& branchName) const {
+  for (size_t t=0; t<trees.size(); ++t) {
+    if (trees[t].name != treeName) continue;
+    const std::vector<std::string>& names = trees[t].branchNames;
+    size_t b = std::find(names.begin(), names.end(), branchName) - names.begin();
+    return (b < names.size()) ? trees[t].accumulators[b] : 0;
+  }
+  return 0;
+}
+
+
+void PartialResult::FixBinnings() {
+  for (size_t t=0; t<trees.size(); ++t) {
+    for (size_t i=0; i<trees[t].accumulators.size(); ++i) trees[t].accumulators[i]->FixBinning();
+  }
+}
+
+
+bool PartialResult::Write(const std::string& fileName, std::ostream& out) const {
+  // Blocks first, so the index knows their offsets
+  std::vector<std::string> blocks;
+  std::ostringstream index;
+  WriteBinary(index, (int) role);
+  WriteBinary(index, (unsigned long long) sources.size());
+  for (size_t s=0; s<sources.size(); ++s) WriteBinary(index, sources[s]);
+  WriteBinary(index, (unsigned long long) trees.size());
+  unsigned long long offset = 0;
+  for (size_t t=0; t<trees.size(); ++t) {
+    WriteBinary(index, trees[t].name);
+    WriteBinary(index, trees[t].entries);
+    WriteBinary(index, (unsigned long long) trees[t].branchNames.size());
+    for (size_t i=0; i<trees[t].branchNames.size(); ++i) {
+      std::ostringstream raw;
+      trees[t].accumulators[i]->Serialise(raw);
+      std::string bytes = raw.str();
+      blocks.push_back(Compress(bytes));
+      WriteBinary(index, trees[t].branchNames[i]);
+      WriteBinary(index, offset);
+      WriteBinary(index, (unsigned long long) blocks.back().size());
+      WriteBinary(index, (unsigned long long) bytes.size());
+      offset += blocks.back().size();
+    }
+  }
+
+  std::string header = index.str();
+  std::ofstream file(fileName.c_str(), std::ios::binary | std::ios::trunc);
+  file.write(kMagic, sizeof(kMagic));
+  WriteBinary(file, (unsigned long long) header.size());
+  file.write(header.data(), header.size());
+  for (size_t b=0; b<blocks.size(); ++b) file.write(blocks[b].data(), blocks[b].size());
+  if (!file) {
+    out<<"Error: partial result "<<fileName<<" cannot be written"<<std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+PartialResult* PartialResult::Read(const std::string& fileName, std::ostream& out, const std::vector<std::string>& branchPatterns) {
+  PartialResultFile file(fileName);
+  if (!file.IsOpen()) {
+    out<<"Error: "<<fileName<<" is not a partial result"<<std::endl;
+    return 0;
+  }
+
+  PartialResult *partial = new PartialResult(file.GetRole());
+  partial->sources = file.GetSources();
+  bool ok = true;
+  const std::vector<PartialResultFile::Tree>& fileTrees = file.GetTrees();
+  for (size_t t=0; ok && t<fileTrees.size(); ++t) {
+    PartialTree tree;
+    tree.name = fileTrees[t].name;
+    tree.entries = fileTrees[t].entries;
+    for (size_t i=0; i<fileTrees[t].blocks.size(); ++i) {
+      const PartialResultFile::Block& block = fileTrees[t].blocks[i];
+      if (!MatchesBranch(branchPatterns, tree.name, block.branch)) continue;
+      BranchAccumulator *accumulator = file.Load(block);
+      ok = accumulator != 0;
+      if (!ok) break;
+      tree.branchNames.push_back(block.branch);
+      tree.accumulators.push_back(accumulator);
+    }
+    partial->trees.push_back(tree); // owned by the partial, also when incomplete
+  }
+  if (!ok) {
+    out<<"Error: partial result "<<fileName<<" is corrupt"<<std::endl;
+    delete partial;
+    return 0;
+  }
+  return partial;
+}
+
+
+PartialResultFile::PartialResultFile(const std::string& fileName)
+  : data(0), size(0), blocksStart(0), role(PartialResult::kInput) {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  struct stat status;
+  if (fd >= 0 && fstat(fd, &status) == 0 && status.st_size > 0) {
+    void *mapped = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      data = (const char*) mapped;
+      size = status.st_size;
+    }
+  }
+  if (fd >= 0) close(fd); // the mapping stays valid
+  if (data && !ReadIndex()) {
+    munmap((void*) data, size);
+    data = 0;
+  }
+}
+
+
+PartialResultFile::~PartialResultFile() {
+  if (data) munmap((void*) data, size);
+}
+
+
+bool PartialResultFile::ReadIndex() {
+  unsigned long long headerSize = 0;
+  size_t fixed = sizeof(kMagic) + sizeof(headerSize);
+  if (size < fixed || !std::equal(data, data + sizeof(kMagic), kMagic)) return false;
+  std::copy(data + sizeof(kMagic), data + fixed, (char*) &headerSize);
+  if (headerSize > size - fixed) return false;
+  blocksStart = fixed + headerSize;
+
+  std::istringstream index(std::string(data + fixed, headerSize));
+  int fileRole = -1;
+  unsigned long long nsources = 0, ntrees = 0;
+  if (!ReadBinary(index, fileRole) || (fileRole != PartialResult::kInput && fileRole != PartialResult::kReference)) return false;
+  role = (PartialResult::Role) fileRole;
+  if (!ReadBinary(index, nsources)) return false;
+  for (unsigned long long s=0; s<nsources; ++s) {
+    std::string source;
+    if (!ReadBinary(index, source)) return false;
+    sources.push_back(source);
+  }
+  if (!ReadBinary(index, ntrees)) return false;
+  for (unsigned long long t=0; t<ntrees; ++t) {
+    Tree tree;
+    unsigned long long nbranches = 0;
+    if (!ReadBinary(index, tree.name) || !ReadBinary(index, tree.entries) || !ReadBinary(index, nbranches)) return false;
+    for (unsigned long long i=0; i<nbranches; ++i) {
+      Block block;
+      if (!ReadBinary(index, block.branch) || !ReadBinary(index, block.offset) ||
+          !ReadBinary(index, block.storedSize) || !ReadBinary(index, block.rawSize)) return false;
+      // Blocks lie within the file and never shrink when decompressed
+      if (block.offset > size - blocksStart || block.storedSize > size - blocksStart - block.offset ||
+          block.storedSize > block.rawSize || block.rawSize > (1ULL << 34)) return false;
+      tree.blocks.push_back(block);
+    }
+    trees.push_back(tree);
+  }
+  return true;
+}
+
+
+BranchAccumulator* PartialResultFile::Load(const Block& block) const {
+  std::string raw(block.rawSize, '\0');
+  if (!Decompress((const unsigned char*) data + blocksStart + block.offset, block.storedSize, raw)) return 0;
+  std::istringstream in(raw);
+  return BranchAccumulator::Deserialise(in);
+}
+
+
+bool MatchesBranch(const std::vector<std::string>& patterns, const std::string& treeName, const std::string& branchName) {
+  if (patterns.empty()) return true;
+  std::string qualified = treeName + "/" + branchName;
+  for (size_t p=0; p<patterns.size(); ++p) {
+    if (fnmatch(patterns[p].c_str(), branchName.c_str(), 0) == 0) return true;
+    if (fnmatch(patterns[p].c_str(), qualified.c_str(), 0) == 0) return true;
+  }
+  return false;
+}
@@ -0,0 +1,122 @@
+#ifndef PARTIALRESULT_H
+#define PARTIALRESULT_H
+
+// Standard Library
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BranchAccumulator.h"
+
+
+// Unfinalised branch accumulators of one tree of a shard
+struct PartialTree {
+  std::string name;
+  Long64_t entries;
+  std::vector<std::string> branchNames;
+  std::vector<BranchAccumulator*> accumulators;
+};
+
+
+// Accumulators filled from one shard of the input or reference files, written
+// by a fill-only run and merged with the other shards before the comparison.
+// Branches are merged by tree and branch name, so shards may differ in the
+// trees or branches they contain.
+//
+// On disk, a header indexes every branch by name to its own compressed block,
+// so only the branches asked for are ever decompressed (PartialResultFile).
+class PartialResult {
+public:
+  enum Role { kInput = 0, kReference = 1 };
+
+  explicit PartialResult(Role sampleRole);
+  ~PartialResult();
+
+  Role GetRole() const { return role; }
+  const std::vector<std::string>& GetSources() const { return sources; }
+  const std::vector<PartialTree>& GetTrees() const { return trees; }
+
+  void AddSource(const std::string& fileName);
+
+  // Takes ownership of the accumulators
+  void AddTree(const std::string& treeName, Long64_t entries, const std::vector<std::string>& branchNames,
+               const std::vector<BranchAccumulator*>& accumulators);
+
+  // Adds the trees of another partial of the same role and deletes it;
+  // bins that do not line up are reported on out
+  void Merge(PartialResult *other, std::ostream& out);
+
+  // Accumulator of a branch of a tree, null if this partial has none
+  const BranchAccumulator* Find(const std::string& treeName, const std::string& branchName) const;
+
+  // Fix the binnings of automatic limits, from the values buffered so far
+  void FixBinnings();
+
+  // Errors are reported on out
+  bool Write(const std::string& fileName, std::ostream& out) const;
+
+  // Only the branches matching any of the patterns (see MatchesBranch) are
+  // read, all branches without patterns; null if unreadable, with the error on out
+  static PartialResult* Read(const std::string& fileName, std::ostream& out,
+                             const std::vector<std::string>& branchPatterns = std::vector<std::string>());
+
+private:
+  PartialResult(const PartialResult&);
+  PartialResult& operator=(const PartialResult&);
+
+  Role role;
+  std::vector<std::string> sources; // shard files
+  std::vector<PartialTree> trees;
+};
+
+
+// Memory-mapped partial result file. Opening reads the index only; the block
+// of a branch is decompressed when it is loaded, so a single branch of a file
+// with thousands of them is read without touching the others.
+class PartialResultFile {
+public:
+  // Position of the block of one branch after the index
+  struct Block {
+    std::string branch;
+    unsigned long long offset;
+    unsigned long long storedSize; // equal to rawSize if stored uncompressed
+    unsigned long long rawSize;
+  };
+
+  struct Tree {
+    std::string name;
+    Long64_t entries;
+    std::vector<Block> blocks;
+  };
+
+  explicit PartialResultFile(const std::string& fileName); // not open if unreadable
+  ~PartialResultFile();
+
+  bool IsOpen() const { return data != 0; }
+  PartialResult::Role GetRole() const { return role; }
+  const std::vector<std::string>& GetSources() const { return sources; }
+  const std::vector<Tree>& GetTrees() const { return trees; }
+
+  // Decompressed accumulator of one branch, null if its block is corrupt
+  BranchAccumulator* Load(const Block& block) const;
+
+private:
+  PartialResultFile(const PartialResultFile&);
+  PartialResultFile& operator=(const PartialResultFile&);
+
+  bool ReadIndex();
+
+  const char *data; // mapped file
+  size_t size;
+  size_t blocksStart;
+  PartialResult::Role role;
+  std::vector<std::string> sources;
+  std::vector<Tree> trees;
+};
+
+
+// True if branchName or treeName/branchName matches any of the shell wildcard
+// patterns, or if there are none
+bool MatchesBranch(const std::vector<std::string>& patterns, const std::string& treeName, const std::string& branchName);
+
+#endif
@@ -0,0 +1,142 @@
+// Standard Library
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "ProgressReporter.h"
+
+// ROOT includes
+#include "TFile.h"
+
+
+namespace {
+  // h:mm:ss
+  std::string Duration(double seconds) {
+    long s = (long) seconds;
+    char text[32];
+    snprintf(text, sizeof(text), "%ld:%02ld:%02ld", s/3600, (s/60)%60, s%60);
+    return text;
+  }
+
+  // Columns of the terminal, so the status line never wraps
+  size_t TerminalWidth() {
+    struct winsize size;
+    if (ioctl(STDERR_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) return size.ws_col;
+    return 80;
+  }
+}
+
+
+// Stream buffer in front of stdout: output clears the status line first
+class ProgressReporter::OutputGuard : public std::streambuf {
+public:
+  OutputGuard(ProgressReporter& owner, std::streambuf *stdoutBuffer) : reporter(owner), target(stdoutBuffer) {}
+
+protected:
+  virtual int overflow(int c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+    char character = traits_type::to_char_type(c);
+    return (xsputn(&character, 1) == 1) ? c : traits_type::eof();
+  }
+
+  virtual std::streamsize xsputn(const char *text, std::streamsize n) {
+    std::lock_guard<std::mutex> lock(reporter.mutex);
+    reporter.Clear();
+    if (n > 0) reporter.lineStart = text[n-1] == '\n';
+    return target->sputn(text, n);
+  }
+
+  virtual int sync() { return target->pubsync(); }
+
+private:
+  ProgressReporter& reporter;
+  std::streambuf *target;
+};
+
+
+ProgressReporter::ProgressReporter(double intervalSeconds)
+  : interval(intervalSeconds), start(std::chrono::steady_clock::now()), bytesAtStart(TFile::GetFileBytesRead()),
+    totalEntries(0), entriesRead(0), stopping(false), drawn(false), lineStart(true) {
+  std::cout<<std::flush;
+  stdoutBuffer = std::cout.rdbuf();
+  guard = new OutputGuard(*this, stdoutBuffer);
+  std::cout.rdbuf(guard);
+  reporter = std::thread(&ProgressReporter::Run, this);
+}
+
+
+ProgressReporter::~ProgressReporter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  stopped.notify_one();
+  reporter.join();
+  std::cout<<std::flush;
+  std::cout.rdbuf(stdoutBuffer);
+  delete guard;
+  Clear();
+}
+
+
+bool ProgressReporter::Interactive() {
+  return isatty(STDERR_FILENO);
+}
+
+
+void ProgressReporter::AddResult(const std::string& branchName, double pvalue) {
+  if (std::isnan(pvalue)) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (worst.size() == kNWorst && pvalue >= worst.back().first) return;
+  worst.insert(std::upper_bound(worst.begin(), worst.end(), std::make_pair(pvalue, branchName)), std::make_pair(pvalue, branchName));
+  if (worst.size() > kNWorst) worst.pop_back();
+}
+
+
+void ProgressReporter::Run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopped.wait_for(lock, interval, [this] { return stopping; })) {
+    if (!lineStart) continue; // never drawn over a half-written line
+    stdoutBuffer->pubsync(); // stdout reaches the terminal before the line
+    std::string status = Status();
+    std::cerr<<"\r\033[K"<<status.substr(0, TerminalWidth()-1)<<std::flush;
+    drawn = true;
+  }
+}
+
+
+void ProgressReporter::Clear() {
+  if (!drawn) return;
+  std::cerr<<"\r\033[K"<<std::flush;
+  drawn = false;
+}
+
+
+// Called with the mutex held
+std::string ProgressReporter::Status() {
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  Long64_t read = entriesRead;
+  Long64_t total = std::max(read, (Long64_t) totalEntries);
+  double megabytes = (TFile::GetFileBytesRead() - bytesAtStart)/(1024.0*1024.0);
+
+  std::ostringstream status;
+  status<<read<<"/"<<total<<" entries";
+  if (seconds > 0) {
+    double rate = read/seconds;
+    status<<", "<<(Long64_t) rate<<" entries/s, "<<std::fixed;
+    status.precision(1);
+    status<<megabytes/seconds<<" MB/s";
+    status.unsetf(std::ios::floatfield);
+    if (rate > 0 && total > read) status<<", ETA "<<Duration((total-read)/rate);
+  }
+  if (!worst.empty()) {
+    status<<" | worst so far:";
+    status.precision(2);
+    for (size_t i=0; i<worst.size(); ++i) status<<" "<<worst[i].second<<" "<<worst[i].first;
+  }
+  return status.str();
+}
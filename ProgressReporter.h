@@ -0,0 +1,72 @@
+#ifndef PROGRESSREPORTER_H
+#define PROGRESSREPORTER_H
+
+// Standard Library
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Rtypes.h"
+
+
+// Status line of a long run on the terminal: entries and megabytes read per
+// second, the estimated time left and the worst branches compared so far.
+// Event loops only add to an atomic entry counter; a reporter thread reads it
+// once per interval and rewrites one line on stderr. While it is shown,
+// stdout goes through a guard of the reporter that clears the line before
+// any output, so the report on the same terminal is never written over it;
+// the line is drawn again at the next interval once a stdout line is complete.
+class ProgressReporter {
+public:
+  explicit ProgressReporter(double intervalSeconds = 1.0);
+  ~ProgressReporter(); // stops the thread, clears the line and restores stdout
+
+  // True if stderr is a terminal; other runs are not reported on
+  static bool Interactive();
+
+  // Entries still to be read, added as the trees are planned; thread safe
+  void AddWork(Long64_t entries) { totalEntries += entries; }
+
+  // Counter the event loops add their entries to
+  std::atomic<Long64_t>* GetEntryCounter() { return &entriesRead; }
+
+  // Smallest uncorrected p-value of a compared branch; thread safe
+  void AddResult(const std::string& branchName, double pvalue);
+
+  // Worst branches shown, by uncorrected p-value
+  static const size_t kNWorst = 3;
+
+private:
+  ProgressReporter(const ProgressReporter&);
+  ProgressReporter& operator=(const ProgressReporter&);
+
+  class OutputGuard;
+
+  void Run();
+  std::string Status();
+  void Clear(); // called with the mutex held
+
+  std::chrono::duration<double> interval;
+  std::chrono::steady_clock::time_point start;
+  Long64_t bytesAtStart;
+  std::atomic<Long64_t> totalEntries;
+  std::atomic<Long64_t> entriesRead;
+
+  std::mutex mutex;
+  std::condition_variable stopped;
+  std::vector<std::pair<double, std::string> > worst; // sorted, at most kNWorst
+  bool stopping;
+  bool drawn; // the status line is on the terminal
+  bool lineStart; // the last stdout output ended a line
+  std::streambuf *stdoutBuffer;
+  OutputGuard *guard;
+  std::thread reporter;
+};
+
+#endif
@@ -0,0 +1,532 @@
+// Regression tests of the comparison engine on small deterministic
+// SimValidation trees with known distributions, one CTest case each:
+//   RegressionTests moments          accumulator moments against analytic values
+//   RegressionTests golden <tool>    p-values and verdicts against golden values
+//   RegressionTests modes <tool>     threaded, entry range, multi-pass, spec-weighted, sharded, single-branch,
+//                                    identical-skipping, daemon and column-cached runs against a single run
+//   RegressionTests schema           branch layout differences between two trees
+// Results of the tool are read back from a result store (--store).
+
+// Standard Library
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "BranchAccumulator.h"
+#include "EventLoop.h"
+#include "ResultStore.h"
+#include "SchemaDiff.h"
+
+// ROOT includes
+#include "TFile.h"
+#include "TH1.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+
+namespace {
+  const Long64_t kEntries = 9800; // multiple of 7 and 200, the periods below
+
+  int failures = 0;
+
+  // Values of one entry. Grids over the quantiles give known moments without
+  // any random numbers; the reference only differs in shifted and binary.
+  struct Sample {
+    Double_t grid;        // uniform on [0, 10]
+    Double_t exponential; // exponential with unit mean
+    Double_t shifted;     // uniform on [0, 10], [5, 15] in the reference
+    Int_t hits;           // 0 to 6, equally often
+    Int_t binary;         // 101 zeros in 200, 99 in the reference
+    Int_t parity;         // 0 and 1, weighted 1 and 2
+    Float_t weight;
+  };
+
+  void FillSample(Long64_t i, bool reference, Sample& sample) {
+    double u = (i + 0.5)/kEntries;
+    sample.grid = 10*u;
+    sample.exponential = -std::log(1 - u);
+    sample.shifted = reference ? 10*u + 5 : 10*u;
+    sample.hits = i % 7;
+    sample.binary = (i % 200 < (reference ? 99 : 101)) ? 0 : 1;
+    sample.parity = i % 2;
+    sample.weight = 1 + i % 2;
+  }
+
+  // Entries [first, last) in ntrees identical trees
+  bool WriteFile(const std::string& fileName, Long64_t first, Long64_t last, bool reference, int ntrees) {
+    TFile file(fileName.c_str(), "RECREATE");
+    if (file.IsZombie()) {
+      std::cout<<"Error: file "<<fileName<<" cannot be written"<<std::endl;
+      return false;
+    }
+    const char *treeNames[] = {"SimValidation", "SimValidationCopy"};
+    for (int t=0; t<ntrees; ++t) {
+      Sample sample;
+      TTree *tree = new TTree(treeNames[t], "regression test");
+      tree->SetAutoFlush(1000); // clusters for the entry ranges of threaded runs
+      tree->Branch("grid", &sample.grid, "grid/D");
+      tree->Branch("exponential", &sample.exponential, "exponential/D");
+      tree->Branch("shifted", &sample.shifted, "shifted/D");
+      tree->Branch("hits", &sample.hits, "hits/I");
+      tree->Branch("binary", &sample.binary, "binary/I");
+      tree->Branch("parity", &sample.parity, "parity/I");
+      tree->Branch("weight", &sample.weight, "weight/F");
+      for (Long64_t i=first; i<last; ++i) {
+        FillSample(i, reference, sample);
+        tree->Fill();
+      }
+      tree->Write();
+    }
+    file.Close();
+    return true;
+  }
+
+  std::string TestFile(const std::string& test, const std::string& name) {
+    std::string directory = gSystem->TempDirectory();
+    return directory + "/SimulationValidationTest_" + test + "_" + std::to_string(getpid()) + "_" + name;
+  }
+
+  void Check(const std::string& what, double value, double expected, double tolerance) {
+    bool bothNaN = std::isnan(value) && std::isnan(expected);
+    if (bothNaN || std::fabs(value - expected) <= tolerance*std::max(1.0, std::fabs(expected))) return;
+    std::cout<<"FAILED: "<<what<<" is "<<value<<", expected "<<expected<<std::endl;
+    ++failures;
+  }
+
+  void CheckTrue(const std::string& what, bool condition) {
+    if (condition) return;
+    std::cout<<"FAILED: "<<what<<std::endl;
+    ++failures;
+  }
+
+  // Run the tool with its output in a log file; the results come from the store
+  bool RunTool(const std::string& tool, const std::string& arguments, const std::string& log) {
+    std::string command = tool + " " + arguments + " > " + log + " 2>&1";
+    int code = std::system(command.c_str());
+    if (code != -1 && WIFEXITED(code)) return true;
+    std::cout<<"FAILED: "<<command<<" did not complete"<<std::endl;
+    ++failures;
+    return false;
+  }
+
+  bool LogContains(const std::string& log, const std::string& text) {
+    std::ifstream in(log.c_str());
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.find(text) != std::string::npos) return true;
+    }
+    return false;
+  }
+
+  bool LoadResults(const std::string& storeFileName, std::vector<BranchResult>& results) {
+    if (ResultStore(storeFileName).Load(-1, results) && !results.empty()) return true;
+    std::cout<<"FAILED: no results stored in "<<storeFileName<<std::endl;
+    ++failures;
+    return false;
+  }
+
+  const BranchResult* FindResult(const std::vector<BranchResult>& results, const std::string& branch) {
+    for (size_t i=0; i<results.size(); ++i) {
+      if (results[i].branch == branch) return &results[i];
+    }
+    std::cout<<"FAILED: no result for branch "<<branch<<std::endl;
+    ++failures;
+    return 0;
+  }
+
+  // Asymptotic Kolmogorov distribution, 2 sum (-1)^(k-1) exp(-2 k^2 z^2)
+  double KolmogorovProbability(double z) {
+    double p = 0;
+    for (int k=1; k<100; ++k) p += ((k % 2) ? 2 : -2)*std::exp(-2.0*k*k*z*z);
+    return p;
+  }
+
+  void FillBranches(TTree *tree, const std::vector<std::string>& names, const std::string& weight,
+                    std::vector<BranchAccumulator*>& accumulators) {
+    std::vector<FillCondition> conditions;
+    for (size_t i=0; i<names.size(); ++i) {
+      accumulators.push_back(new BranchAccumulator("plt_"+names[i]+weight, 100, 0, -9999));
+      conditions.push_back(FillCondition("", weight));
+    }
+    CheckTrue("filling "+weight, FillAccumulators(tree, names, accumulators, conditions, std::cout));
+  }
+
+
+  // Moments of the accumulators against the moments of the sampled distributions
+  void TestMoments() {
+    std::string inputFileName = TestFile("moments", "input.root");
+    if (!WriteFile(inputFileName, 0, kEntries, false, 1)) { ++failures; return; }
+    TFile inputFile(inputFileName.c_str());
+    TTree *tree = (TTree*) inputFile.Get("SimValidation");
+
+    std::vector<std::string> names;
+    names.push_back("grid");
+    names.push_back("exponential");
+    names.push_back("hits");
+    std::vector<BranchAccumulator*> accs;
+    FillBranches(tree, names, "", accs);
+
+    // Uniform grid: exact mean, variance 100 (N^2 - 1)/(12 N^2), no skewness
+    double n = kEntries;
+    Check("grid entries", accs[0]->GetEntries(), n, 0);
+    Check("grid mean", accs[0]->GetMean(), 5, 1e-12);
+    Check("grid standard deviation", accs[0]->GetStdDev(), 10*std::sqrt((n*n - 1)/(12*n*n)), 1e-12);
+    Check("grid skewness", accs[0]->GetSkewness(), 0, 1e-9);
+    Check("grid mean error", accs[0]->GetMeanError(), accs[0]->GetStdDev()/std::sqrt(n), 1e-12);
+
+    // Exponential quantiles: mean 1, standard deviation 1, skewness 2, up to the missing tail beyond 1/(2N)
+    Check("exponential mean", accs[1]->GetMean(), 1, 2e-3);
+    Check("exponential standard deviation", accs[1]->GetStdDev(), 1, 1e-2);
+    Check("exponential skewness", accs[1]->GetSkewness(), 2, 0.1);
+
+    // Integers 0 to 6 equally often, counted exactly
+    CheckTrue("hits counted exactly", accs[2]->HasExactCounts());
+    Check("hits mean", accs[2]->GetMean(), 3, 1e-12);
+    Check("hits standard deviation", accs[2]->GetStdDev(), 2, 1e-12);
+    Check("hits skewness", accs[2]->GetSkewness(), 0, 1e-9);
+    Check("hits bins", accs[2]->GetHistogram()->GetNbinsX(), 7, 0);
+    Check("hits bin content", accs[2]->GetHistogram()->GetBinContent(4), n/7, 0);
+
+    // Weighted parity: mean 2/3, variance 2/9, effective entries (1.5 N)^2/(2.5 N)
+    std::vector<std::string> parity(1, "parity");
+    std::vector<BranchAccumulator*> direct, formula;
+    FillBranches(tree, parity, "weight", direct);
+    FillBranches(tree, parity, "1*weight", formula);
+    Check("weighted parity mean", direct[0]->GetMean(), 2.0/3, 1e-12);
+    Check("weighted parity standard deviation", direct[0]->GetStdDev(), std::sqrt(2.0)/3, 1e-12);
+    Check("weighted parity effective entries", direct[0]->GetEffectiveEntries(), 0.9*n, 1e-12);
+    Check("weighted parity sum of weights", direct[0]->GetSumOfWeights(), 1.5*n, 0);
+
+    // A weight branch read directly and through TTreeFormula gives the same fill
+    Check("branch and formula weight means", direct[0]->GetMean(), formula[0]->GetMean(), 0);
+    Check("branch and formula weight effective entries", direct[0]->GetEffectiveEntries(), formula[0]->GetEffectiveEntries(), 0);
+
+    // Exact counting stopped by a wide span of values stays stopped when a filler is created again
+    BranchAccumulator wide("plt_wide", 100, 0, -9999);
+    wide.EnableExactCounting();
+    for (int v=0; v<=BranchAccumulator::kMaxExactValues; v+=100) wide.Fill(v, 1);
+    wide.Fill(BranchAccumulator::kMaxExactValues + 1, 1);
+    wide.FixBinning();
+    wide.EnableExactCounting();
+    wide.Fill(1, 1);
+    wide.Finalise();
+    CheckTrue("exact counting stays stopped", !wide.HasExactCounts());
+    Check("wide entries", wide.GetEntries(), 13, 0);
+
+    for (size_t i=0; i<accs.size(); ++i) delete accs[i];
+    delete direct[0];
+    delete formula[0];
+    delete tree;
+    inputFile.Close();
+    gSystem->Unlink(inputFileName.c_str());
+  }
+
+
+  // Statistics and verdicts of a comparison against golden and analytic values
+  void TestGolden(const std::string& tool) {
+    std::string inputFileName = TestFile("golden", "input.root");
+    std::string refFileName = TestFile("golden", "reference.root");
+    std::string storeFileName = TestFile("golden", "store.root");
+    if (!WriteFile(inputFileName, 0, kEntries, false, 1) || !WriteFile(refFileName, 0, kEntries, true, 1)) { ++failures; return; }
+
+    std::string log = TestFile("golden", "log.txt");
+    std::vector<BranchResult> results;
+    if (RunTool(tool, "-i "+inputFileName+" -r "+refFileName+" --store "+storeFileName, log)
+        && LoadResults(storeFileName, results)) {
+      Check("number of branches", results.size(), 7, 0);
+
+      // Without a spec only the default tests run: no opt-in verdict, and the
+      // summary family is the Kolmogorov and Chi2 p-values of every branch
+      CheckTrue("default summary family", LogContains(log, "Branches compared: 7 ; p-values: 14"));
+      CheckTrue("no opt-in verdict by default", !LogContains(log, "Wasserstein distance above"));
+
+      // Identical samples
+      const char *identical[] = {"grid", "exponential", "hits", "parity", "weight"};
+      for (int k=0; k<5; ++k) {
+        const BranchResult *result = FindResult(results, identical[k]);
+        if (!result) continue;
+        Check(std::string(identical[k])+" Kolmogorov", result->ks, 1, 1e-12);
+        Check(std::string(identical[k])+" Chi2 test", result->chi2, 1, 1e-12);
+        Check(std::string(identical[k])+" reference mean", result->refMean, result->mean, 1e-12);
+        CheckTrue(std::string(identical[k])+" passes", result->pass);
+      }
+      const BranchResult *grid = FindResult(results, "grid");
+      if (grid) Check("grid mean", grid->mean, 5, 1e-12);
+
+      // 4949 and 4851 zeros: exact Chi2 of 2 (98)^2/9800 = 1.96 with one degree of
+      // freedom, p = erfc(sqrt(0.98)); Kolmogorov distance 0.01 at z = 0.01 sqrt(4900)
+      const BranchResult *binary = FindResult(results, "binary");
+      if (binary) {
+        Check("binary Chi2 test", binary->chi2, 0.16151331846754208, 1e-9);
+        Check("binary Chi2 test, analytic", binary->chi2, std::erfc(std::sqrt(0.98)), 1e-9);
+        Check("binary Kolmogorov", binary->ks, 0.7112351950296891, 1e-6);
+        Check("binary Kolmogorov, analytic", binary->ks, KolmogorovProbability(0.7), 1e-6);
+        Check("binary mean", binary->mean, 4851.0/9800, 1e-12);
+        Check("binary reference mean", binary->refMean, 4949.0/9800, 1e-12);
+      }
+
+      // Shifted by half the range: fails, with a vanishing Kolmogorov probability
+      const BranchResult *shifted = FindResult(results, "shifted");
+      if (shifted) {
+        CheckTrue("shifted fails", !shifted->pass);
+        Check("shifted reference mean", shifted->refMean, 10, 1e-12);
+        CheckTrue("shifted Kolmogorov below 1e-10", shifted->ks < 1e-10);
+      }
+    }
+    gSystem->Unlink(inputFileName.c_str());
+    gSystem->Unlink(refFileName.c_str());
+    gSystem->Unlink(storeFileName.c_str());
+    gSystem->Unlink(log.c_str());
+  }
+
+
+  // Within the summation order only, unless tolerance is given
+  void CompareRuns(const std::string& mode, const std::vector<BranchResult>& expected, const std::vector<BranchResult>& results,
+                   double tolerance = 1e-9) {
+    Check(mode+" number of branches", results.size(), expected.size(), 0);
+    for (size_t i=0; i<expected.size(); ++i) {
+      const BranchResult *result = FindResult(results, expected[i].branch);
+      if (!result) continue;
+      std::string name = mode + " " + expected[i].branch;
+      Check(name+" mean", result->mean, expected[i].mean, tolerance);
+      Check(name+" mean error", result->meanError, expected[i].meanError, tolerance);
+      Check(name+" standard deviation", result->std, expected[i].std, tolerance);
+      Check(name+" skewness", result->skewness, expected[i].skewness, tolerance);
+      Check(name+" effective entries", result->neff, expected[i].neff, tolerance);
+      Check(name+" reference mean", result->refMean, expected[i].refMean, tolerance);
+      Check(name+" reference mean error", result->refMeanError, expected[i].refMeanError, tolerance);
+      Check(name+" reference standard deviation", result->refStd, expected[i].refStd, tolerance);
+      Check(name+" reference skewness", result->refSkewness, expected[i].refSkewness, tolerance);
+      Check(name+" reference effective entries", result->refNeff, expected[i].refNeff, tolerance);
+      Check(name+" Kolmogorov", result->ks, expected[i].ks, tolerance);
+      Check(name+" Chi2 test", result->chi2, expected[i].chi2, tolerance);
+      CheckTrue(name+" verdict", result->pass == expected[i].pass);
+    }
+  }
+
+
+  // Threaded, entry range, multi-pass, spec-weighted, sharded, single-branch, identical-skipping, daemon and
+  // column-cached runs over two trees against one single-threaded pass
+  void TestModes(const std::string& tool) {
+    std::string inputFileName = TestFile("modes", "input.root");
+    std::string refFileName = TestFile("modes", "reference.root");
+    std::string shardA = TestFile("modes", "input_a.root");
+    std::string shardB = TestFile("modes", "input_b.root");
+    std::string specFileName = TestFile("modes", "spec.txt");
+    std::string log = TestFile("modes", "log.txt");
+    if (!WriteFile(inputFileName, 0, kEntries, false, 2) || !WriteFile(refFileName, 0, kEntries, true, 2) ||
+        !WriteFile(shardA, 0, kEntries/2, false, 2) || !WriteFile(shardB, kEntries/2, kEntries, false, 2)) { ++failures; return; }
+
+    // Fixed ranges, so the shards are binned alike
+    std::ofstream spec(specFileName.c_str());
+    spec<<"[grid|exponential|shifted]"<<std::endl<<"range = 0 20"<<std::endl;
+    spec.close();
+
+    std::string common = "-t 'SimValidation*' -w weight --spec " + specFileName;
+    std::string files = " -i " + inputFileName + " -r " + refFileName + " ";
+    // Two threads take a tree each, four also split the trees into entry ranges
+    const char *modes[] = {"single", "threads", "ranges", "passes"};
+    const char *options[] = {"-j 1", "-j 2", "-j 4", "--memoryBudget 1"};
+    std::vector<BranchResult> expected, ranged;
+    for (int m=0; m<4; ++m) {
+      std::string storeFileName = TestFile("modes", std::string(modes[m]) + ".root");
+      std::vector<BranchResult> results;
+      if (RunTool(tool, common + files + options[m] + " --store " + storeFileName, log) && LoadResults(storeFileName, results)) {
+        if (m == 0) expected = results;
+        else CompareRuns(modes[m], expected, results);
+        if (m == 2) ranged = results;
+      }
+      gSystem->Unlink(storeFileName.c_str());
+    }
+
+    // Weights given only in the spec weight the reference as well
+    std::string weightedSpecFileName = TestFile("modes", "weighted.txt");
+    std::ofstream weightedSpec(weightedSpecFileName.c_str());
+    weightedSpec<<"[.*]"<<std::endl<<"weight = weight"<<std::endl;
+    weightedSpec<<"[grid|exponential|shifted]"<<std::endl<<"range = 0 20"<<std::endl;
+    weightedSpec.close();
+    std::string weightedStoreFileName = TestFile("modes", "weighted.root");
+    std::vector<BranchResult> weighted;
+    if (RunTool(tool, "-t 'SimValidation*' --spec " + weightedSpecFileName + files + "-j 1 --store " + weightedStoreFileName, log)
+        && LoadResults(weightedStoreFileName, weighted)) {
+      CompareRuns("spec weighted", expected, weighted);
+    }
+    gSystem->Unlink(weightedSpecFileName.c_str());
+    gSystem->Unlink(weightedStoreFileName.c_str());
+
+    // Ranges are merged in entry order, whichever thread filled them: repeated runs agree exactly
+    std::string storeFileName = TestFile("modes", "merged.root");
+    std::vector<BranchResult> repeated;
+    if (!ranged.empty() && RunTool(tool, common + files + options[2] + " --store " + storeFileName, log)
+        && LoadResults(storeFileName, repeated)) {
+      CompareRuns("ranges repeated", ranged, repeated, 0);
+    }
+    gSystem->Unlink(storeFileName.c_str());
+
+    // Two input shards and the reference filled apart, then merged
+    std::string partA = TestFile("modes", "a.part");
+    std::string partB = TestFile("modes", "b.part");
+    std::string partRef = TestFile("modes", "reference.part");
+    bool filled = RunTool(tool, common + " -i " + shardA + " --fillOnly " + partA, log) &&
+                  RunTool(tool, common + " -i " + shardB + " --fillOnly " + partB, log) &&
+                  RunTool(tool, common + " -r " + refFileName + " --fillOnly " + partRef, log);
+    std::vector<BranchResult> results;
+    if (filled && RunTool(tool, common + " --merge " + partA + " " + partB + " " + partRef + " --store " + storeFileName, log)
+        && LoadResults(storeFileName, results)) {
+      CompareRuns("merged", expected, results);
+    }
+
+    // One branch per tree read from the indexed partial results
+    std::vector<BranchResult> selected, selectedExpected;
+    for (size_t i=0; i<expected.size(); ++i) {
+      const std::string& branch = expected[i].branch;
+      if (branch.size() > 8 && branch.compare(branch.size()-8, 8, "/shifted") == 0) selectedExpected.push_back(expected[i]);
+    }
+    gSystem->Unlink(storeFileName.c_str());
+    if (filled && RunTool(tool, common + " -b shifted --merge " + partA + " " + partB + " " + partRef + " --store " + storeFileName, log)
+        && LoadResults(storeFileName, selected)) {
+      CompareRuns("selected", selectedExpected, selected);
+    }
+
+    // Automatic limits: the later shards take the binning of the first one
+    std::string automatic = "-t 'SimValidation*' -w weight";
+    std::string autoA = TestFile("modes", "auto_a.part");
+    std::string autoB = TestFile("modes", "auto_b.part");
+    std::string autoRef = TestFile("modes", "auto_reference.part");
+    std::vector<BranchResult> autoExpected, autoMerged;
+    gSystem->Unlink(storeFileName.c_str());
+    if (RunTool(tool, automatic + files + "-j 1 --store " + storeFileName, log) && LoadResults(storeFileName, autoExpected)
+        && RunTool(tool, automatic + " -i " + shardA + " --fillOnly " + autoA, log)
+        && RunTool(tool, automatic + " -i " + shardB + " --fillOnly " + autoB + " --binningFrom " + autoA, log)
+        && RunTool(tool, automatic + " -r " + refFileName + " --fillOnly " + autoRef + " --binningFrom " + autoA, log)) {
+      gSystem->Unlink(storeFileName.c_str());
+      if (RunTool(tool, automatic + " --merge " + autoA + " " + autoB + " " + autoRef + " --store " + storeFileName, log)
+          && LoadResults(storeFileName, autoMerged)) {
+        CompareRuns("merged automatic", autoExpected, autoMerged);
+        CheckTrue("merged automatic bins line up", !LogContains(log, "incompatible binning"));
+      }
+    }
+
+    // Only the branches that differ are compared once identical ones are skipped;
+    // those are still stored, passing, so a later --diff does not miss them
+    std::vector<BranchResult> skipped, different, differentExpected;
+    gSystem->Unlink(storeFileName.c_str());
+    if (RunTool(tool, common + files + "--skipIdentical --store " + storeFileName, log) && LoadResults(storeFileName, skipped)) {
+      Check("identical skipped number of stored branches", skipped.size(), expected.size(), 0);
+      for (size_t i=0; i<expected.size(); ++i) {
+        const std::string& branch = expected[i].branch;
+        bool differs = (branch.size() > 8 && branch.compare(branch.size()-8, 8, "/shifted") == 0) ||
+                       (branch.size() > 7 && branch.compare(branch.size()-7, 7, "/binary") == 0);
+        const BranchResult *result = FindResult(skipped, branch);
+        if (!result) continue;
+        if (differs) {
+          differentExpected.push_back(expected[i]);
+          different.push_back(*result);
+        }
+        else CheckTrue("identical skipped " + branch + " stored as passing", result->pass && result->ks == 1 && result->chi2 == 1);
+      }
+      CompareRuns("identical skipped", differentExpected, different);
+    }
+
+    // Two runs served by a daemon, the second with the files already open
+    std::string socketPath = TestFile("modes", "daemon.sock");
+    std::string daemonLog = TestFile("modes", "daemon.txt");
+    std::string serve = tool + " --serve " + socketPath + " -j 2 > " + daemonLog + " 2>&1 &";
+    if (std::system(serve.c_str()) == 0) {
+      for (int wait=0; wait<100 && access(socketPath.c_str(), F_OK) != 0; ++wait) usleep(100000);
+      for (int run=0; run<2; ++run) {
+        std::vector<BranchResult> served;
+        gSystem->Unlink(storeFileName.c_str());
+        if (RunTool(tool, common + files + "--daemon " + socketPath + " --store " + storeFileName, log) && LoadResults(storeFileName, served)) {
+          CompareRuns("daemon", expected, served);
+        }
+      }
+      RunTool(tool, "--daemon " + socketPath + " --stopDaemon", log);
+      for (int wait=0; wait<100 && access(socketPath.c_str(), F_OK) == 0; ++wait) usleep(100000);
+      CheckTrue("daemon served both runs", LogContains(daemonLog, "stopped after 2 requests"));
+    }
+
+    // Columns built by the first run are mapped by the second, read in entry ranges
+    std::string columnDirectory = TestFile("modes", "columns");
+    const char *columnOptions[] = {"-j 1", "-j 4"};
+    for (int run=0; run<2; ++run) {
+      std::vector<BranchResult> cached;
+      gSystem->Unlink(storeFileName.c_str());
+      if (RunTool(tool, common + files + columnOptions[run] + " --columnCache " + columnDirectory + " --store " + storeFileName, log)
+          && LoadResults(storeFileName, cached)) {
+        CompareRuns(run == 0 ? "columns built" : "columns mapped", expected, cached);
+      }
+    }
+    void *columnFiles = gSystem->OpenDirectory(columnDirectory.c_str());
+    const char *columnFile;
+    while (columnFiles && (columnFile = gSystem->GetDirEntry(columnFiles))) {
+      if (columnFile[0] != '.') gSystem->Unlink((columnDirectory + "/" + columnFile).c_str());
+    }
+    if (columnFiles) gSystem->FreeDirectory(columnFiles);
+    gSystem->Unlink(columnDirectory.c_str());
+
+    const std::string testFiles[] = {inputFileName, refFileName, shardA, shardB, specFileName, storeFileName, partA, partB, partRef,
+                                     autoA, autoB, autoRef, daemonLog};
+    for (int f=0; f<13; ++f) gSystem->Unlink(testFiles[f].c_str());
+  }
+
+
+  // Removed, added, renamed and retyped branches, from the tree headers only
+  void TestSchema() {
+    Double_t value = 0;
+    Int_t hits = 0, ntracks = 0;
+    Long64_t longHits = 0;
+    Float_t tracks[4] = {0, 0, 0, 0};
+    TTree tree("SimValidation", "schema test");
+    tree.Branch("grid", &value, "grid/D");
+    tree.Branch("oldName", &value, "oldName/D");
+    tree.Branch("hits", &hits, "hits/I");
+    tree.Branch("tracks", tracks, "tracks[4]/F");
+    TTree reftree("SimValidation", "schema test");
+    reftree.Branch("grid", &value, "grid/D");
+    reftree.Branch("newName", &value, "newName/D");
+    reftree.Branch("hits", &longHits, "hits/L");
+    reftree.Branch("ntracks", &ntracks, "ntracks/I");
+    reftree.Branch("tracks", tracks, "tracks[ntracks]/F");
+
+    SchemaDiff diff = DiffSchemas(&tree, &reftree);
+    diff.Print(std::cout);
+    CheckTrue("schema differs", !diff.Identical());
+    CheckTrue("compared branches", diff.common.size() == 3 && diff.common[0] == "grid" && diff.common[1] == "hits" && diff.common[2] == "tracks");
+    CheckTrue("branch only in the input", diff.inputOnly.size() == 1 && diff.inputOnly[0].name == "oldName");
+    CheckTrue("branches only in the reference", diff.referenceOnly.size() == 2 && diff.referenceOnly[0].name == "newName" && diff.referenceOnly[1].name == "ntracks");
+    CheckTrue("changed branches", diff.changed.size() == 2 && diff.changed[0].first.name == "hits" && diff.changed[1].first.name == "tracks");
+    if (diff.changed.size() == 2) {
+      CheckTrue("changed type", diff.changed[0].first.type == "Int_t" && diff.changed[0].second.type == "Long64_t");
+      CheckTrue("changed shape", diff.changed[1].first.type == "Float_t[4]" && diff.changed[1].second.type == "Float_t[ntracks]");
+    }
+    CheckTrue("renamed branch", diff.renamed.size() == 1 && diff.renamed[0].first == "oldName" && diff.renamed[0].second == "newName");
+    CheckTrue("identical schema", DiffSchemas(&tree, &tree).Identical());
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  std::string test = (argc > 1) ? argv[1] : "";
+  std::string tool = (argc > 2) ? argv[2] : "";
+  TH1::AddDirectory(kFALSE);
+
+  if (test == "moments") TestMoments();
+  else if (test == "golden" && !tool.empty()) TestGolden(tool);
+  else if (test == "modes" && !tool.empty()) TestModes(tool);
+  else if (test == "schema") TestSchema();
+  else {
+    std::cout<<"Usage: RegressionTests moments | golden <SimulationValidationTool> | modes <SimulationValidationTool> | schema"<<std::endl;
+    return 1;
+  }
+
+  if (failures == 0) std::cout<<"Test "<<test<<" passed"<<std::endl;
+  else std::cout<<"Test "<<test<<": "<<failures<<" checks FAILED"<<std::endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+// Standard Library
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "Resampling.h"
+
+// ROOT includes
+#include "TH1.h"
+
+
+namespace {
+  const int kBlockSize = 64; // resamples per RNG stream
+
+  // Threads added by all resampling calls in the process. Branches are
+  // resampled from tree and daemon workers at once, so together they add no
+  // more threads than there are further cores.
+  std::atomic<int> extraThreads(0);
+
+  int AcquireThreads(int wanted) {
+    int limit = (int) std::max(1u, std::thread::hardware_concurrency()) - 1;
+    int running = extraThreads.load();
+    int granted;
+    do {
+      granted = std::max(0, std::min(wanted, limit - running));
+      if (granted == 0) return 0;
+    } while (!extraThreads.compare_exchange_weak(running, running + granted));
+    return granted;
+  }
+
+  // Bin contents scaled to the effective number of entries of the histogram
+  double EffectiveCounts(const TH1 *h, std::vector<double>& counts) {
+    int nbins = h->GetNbinsX();
+    counts.assign(nbins, 0);
+    double sum = 0;
+    double sumErr2 = 0;
+    for (int i=1; i<=nbins; ++i) {
+      counts[i-1] = h->GetBinContent(i);
+      sum += counts[i-1];
+      sumErr2 += h->GetBinError(i)*h->GetBinError(i);
+    }
+    if (sum <= 0 || sumErr2 <= 0) return 0;
+    double neff = sum*sum/sumErr2;
+    for (int i=0; i<nbins; ++i) counts[i] *= neff/sum;
+    return neff;
+  }
+
+  // Multinomial draw through successive conditional binomials, one per bin
+  void DrawMultinomial(std::mt19937_64& rng, long n, const std::vector<double>& prob, std::vector<double>& counts) {
+    double remaining = 1;
+    for (size_t i=0; i<prob.size(); ++i) {
+      long k = 0;
+      if (n > 0 && prob[i] > 0) {
+        double p = (remaining > prob[i]) ? prob[i]/remaining : 1.0;
+        std::binomial_distribution<long> binomial(n, p);
+        k = binomial(rng);
+      }
+      counts[i] = k;
+      n -= k;
+      remaining -= prob[i];
+    }
+  }
+}
+
+
+double KolmogorovDistance(const std::vector<double>& a, const std::vector<double>& b) {
+  double suma = 0, sumb = 0;
+  for (size_t i=0; i<a.size(); ++i) { suma += a[i]; sumb += b[i]; }
+  if (suma <= 0 || sumb <= 0) return 0;
+  double cdfa = 0, cdfb = 0, dmax = 0;
+  for (size_t i=0; i<a.size(); ++i) {
+    cdfa += a[i]/suma;
+    cdfb += b[i]/sumb;
+    dmax = std::max(dmax, std::fabs(cdfa-cdfb));
+  }
+  return dmax;
+}
+
+
+double Chi2Distance(const std::vector<double>& a, const std::vector<double>& b) {
+  double suma = 0, sumb = 0;
+  for (size_t i=0; i<a.size(); ++i) { suma += a[i]; sumb += b[i]; }
+  if (suma <= 0 || sumb <= 0) return 0;
+  double ra = std::sqrt(sumb/suma);
+  double rb = std::sqrt(suma/sumb);
+  double chi2 = 0;
+  for (size_t i=0; i<a.size(); ++i) {
+    double n = a[i] + b[i];
+    if (n <= 0) continue;
+    double d = a[i]*ra - b[i]*rb;
+    chi2 += d*d/n;
+  }
+  return chi2;
+}
+
+
+ResampledPValues ResampleTest(const TH1 *h, const TH1 *href, const ResamplingConfig& config, unsigned long streamId) {
+  ResampledPValues result;
+  result.ks = std::numeric_limits<double>::quiet_NaN();
+  result.chi2 = std::numeric_limits<double>::quiet_NaN();
+  result.nResamples = 0;
+
+  std::vector<double> a, b;
+  double na = EffectiveCounts(h, a);
+  double nb = EffectiveCounts(href, b);
+  if (config.nResamples <= 0 || na <= 0 || nb <= 0 || a.size() != b.size()) return result;
+  if (h->GetDimension() > 1) return result; // the binned distances are defined along one axis
+
+  double ksObserved = KolmogorovDistance(a, b);
+  double chi2Observed = Chi2Distance(a, b);
+
+  // Null hypothesis: both samples follow the pooled shape
+  std::vector<double> pooled(a.size());
+  for (size_t i=0; i<a.size(); ++i) pooled[i] = (a[i]+b[i])/(na+nb);
+  long sizeA = std::max(1L, std::lround(na));
+  long sizeB = std::max(1L, std::lround(nb));
+
+  int nblocks = (config.nResamples + kBlockSize - 1)/kBlockSize;
+  std::atomic<int> nextBlock(0);
+  std::mutex resultMutex;
+  long ksExceed = 0, chi2Exceed = 0, drawn = 0;
+
+  bool limited = config.timeBudget > 0;
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+    + std::chrono::microseconds((long long)(config.timeBudget*1e6));
+
+  auto worker = [&]() {
+    std::vector<double> ra(a.size()), rb(b.size());
+    long myKs = 0, myChi2 = 0, myDrawn = 0;
+    int block;
+    while ((block = nextBlock++) < nblocks) {
+      if (limited && std::chrono::steady_clock::now() > deadline) break;
+      // Each block owns a reproducible stream, independent of the thread running it
+      std::seed_seq seq{(unsigned long)config.seed, streamId, (unsigned long)block};
+      std::mt19937_64 rng(seq);
+      int first = block*kBlockSize;
+      int last = std::min(config.nResamples, first + kBlockSize);
+      for (int r=first; r<last; ++r) {
+        DrawMultinomial(rng, sizeA, pooled, ra);
+        DrawMultinomial(rng, sizeB, pooled, rb);
+        if (KolmogorovDistance(ra, rb) >= ksObserved) ++myKs;
+        if (Chi2Distance(ra, rb) >= chi2Observed) ++myChi2;
+        ++myDrawn;
+      }
+    }
+    std::lock_guard<std::mutex> lock(resultMutex);
+    ksExceed += myKs;
+    chi2Exceed += myChi2;
+    drawn += myDrawn;
+  };
+
+  // The calling thread always draws, helped by as many threads as are free
+  int nthreads = std::max(1, std::min(config.nThreads, nblocks));
+  int nextra = AcquireThreads(nthreads - 1);
+  std::vector<std::thread> threads;
+  for (int t=0; t<nextra; ++t) threads.push_back(std::thread(worker));
+  worker();
+  for (size_t t=0; t<threads.size(); ++t) threads[t].join();
+  extraThreads -= nextra;
+
+  if (drawn > 0) {
+    result.ks = (ksExceed + 1.0)/(drawn + 1.0);
+    result.chi2 = (chi2Exceed + 1.0)/(drawn + 1.0);
+  }
+  result.nResamples = drawn;
+  return result;
+}
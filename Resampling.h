@@ -0,0 +1,43 @@
+#ifndef RESAMPLING_H
+#define RESAMPLING_H
+
+// Standard Library
+#include <vector>
+
+class TH1;
+
+
+// Settings of the resampling engine
+struct ResamplingConfig {
+  int nResamples;       // 0 disables resampling
+  double timeBudget;    // seconds per branch, 0 for no limit
+  int nThreads;
+  unsigned long seed;
+
+  ResamplingConfig() : nResamples(0), timeBudget(0), nThreads(1), seed(4357) {}
+};
+
+
+struct ResampledPValues {
+  double ks;
+  double chi2;
+  int nResamples; // resamples actually drawn within the time budget
+};
+
+
+// Bootstrap p-values of the KS and Chi2 distances between two filled
+// histograms, without going back to the trees. Under the null hypothesis both
+// samples are drawn from the pooled shape, with the effective entries of each
+// histogram as sample sizes, so weighted histograms are handled as well.
+// Only one-dimensional histograms are supported.
+// Resamples are drawn in fixed blocks, each with its own RNG stream seeded from
+// (seed, streamId, block), so results do not depend on the number of threads.
+// The calling thread draws with up to nThreads-1 helpers; the helpers of all
+// concurrent calls together are capped by the hardware concurrency.
+ResampledPValues ResampleTest(const TH1 *h, const TH1 *href, const ResamplingConfig& config, unsigned long streamId);
+
+// Binned two-sample distances used by ResampleTest, exposed for reuse
+double KolmogorovDistance(const std::vector<double>& a, const std::vector<double>& b);
+double Chi2Distance(const std::vector<double>& a, const std::vector<double>& b);
+
+#endif
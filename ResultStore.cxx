@@ -0,0 +1,307 @@
+// Standard Library
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <set>
+
+#include "ResultStore.h"
+
+// ROOT includes
+#include "TFile.h"
+#include "TTree.h"
+
+
+namespace {
+  const int kNameLength = 256;
+  const int kPathLength = 1024;
+  const double kMeanShiftSigma = 3.0;
+
+  struct ResultRow {
+    Int_t run;
+    Int_t branchHash;
+    Char_t branch[kNameLength];
+    Double_t mean, meanError, std, skewness, neff;
+    Double_t refMean, refMeanError, refStd, refSkewness, refNeff;
+    Double_t ks, chi2;
+    Bool_t pass;
+  };
+
+  struct RunRow {
+    Int_t run;
+    Long64_t time;
+    Long64_t firstEntry; // first entry of this run in the results tree
+    Int_t nBranches;
+    Char_t version[kNameLength];
+    Char_t input[kPathLength];
+    Char_t reference[kPathLength];
+  };
+
+  struct Column {
+    const char *name;
+    void *address;
+    const char *leaflist;
+  };
+
+  std::vector<Column> ResultColumns(ResultRow& row) {
+    Column columns[] = {
+      {"run", &row.run, "run/I"},
+      {"branchHash", &row.branchHash, "branchHash/I"},
+      {"branch", row.branch, "branch/C"},
+      {"mean", &row.mean, "mean/D"},
+      {"meanError", &row.meanError, "meanError/D"},
+      {"std", &row.std, "std/D"},
+      {"skewness", &row.skewness, "skewness/D"},
+      {"neff", &row.neff, "neff/D"},
+      {"refMean", &row.refMean, "refMean/D"},
+      {"refMeanError", &row.refMeanError, "refMeanError/D"},
+      {"refStd", &row.refStd, "refStd/D"},
+      {"refSkewness", &row.refSkewness, "refSkewness/D"},
+      {"refNeff", &row.refNeff, "refNeff/D"},
+      {"ks", &row.ks, "ks/D"},
+      {"chi2", &row.chi2, "chi2/D"},
+      {"pass", &row.pass, "pass/O"}
+    };
+    return std::vector<Column>(columns, columns + sizeof(columns)/sizeof(Column));
+  }
+
+  std::vector<Column> RunColumns(RunRow& row) {
+    Column columns[] = {
+      {"run", &row.run, "run/I"},
+      {"time", &row.time, "time/L"},
+      {"firstEntry", &row.firstEntry, "firstEntry/L"},
+      {"nBranches", &row.nBranches, "nBranches/I"},
+      {"version", row.version, "version/C"},
+      {"input", row.input, "input/C"},
+      {"reference", row.reference, "reference/C"}
+    };
+    return std::vector<Column>(columns, columns + sizeof(columns)/sizeof(Column));
+  }
+
+  // Attach a tree to the row, creating it in the current directory if needed
+  TTree* OpenTree(TFile& file, const char *name, const char *title, const std::vector<Column>& columns, bool create) {
+    TTree *tree = (TTree*) file.Get(name);
+    if (tree) {
+      for (size_t i=0; i<columns.size(); ++i) tree->SetBranchAddress(columns[i].name, columns[i].address);
+    }
+    else if (create) {
+      file.cd();
+      tree = new TTree(name, title);
+      for (size_t i=0; i<columns.size(); ++i) tree->Branch(columns[i].name, columns[i].address, columns[i].leaflist);
+    }
+    return tree;
+  }
+
+  void CopyString(Char_t *target, const std::string& source, size_t length) {
+    std::strncpy(target, source.c_str(), length-1);
+    target[length-1] = '\0';
+  }
+
+  // Store accessor for reading: both trees bound to rows
+  struct StoreReader {
+    TFile file;
+    TTree *runs;
+    TTree *results;
+    RunRow run;
+    ResultRow row;
+
+    explicit StoreReader(const std::string& fileName) : file(fileName.c_str(), "READ"), runs(0), results(0) {
+      if (file.IsZombie()) return;
+      runs = OpenTree(file, "runs", "", RunColumns(run), false);
+      results = OpenTree(file, "results", "", ResultColumns(row), false);
+    }
+
+    bool IsValid() const { return runs && results && runs->GetEntries() > 0; }
+
+    // Load the result of a branch in a run through the index; falls back to a
+    // scan of the run block on a hash collision
+    bool LoadResult(const std::string& branchName, int runNumber) {
+      if (results->GetEntryWithIndex(ResultStore::BranchHash(branchName), runNumber) > 0
+          && branchName == row.branch) return true;
+      runs->GetEntry(runNumber);
+      for (Long64_t entry=run.firstEntry; entry<run.firstEntry+run.nBranches; ++entry) {
+        results->GetEntry(entry);
+        if (branchName == row.branch) return true;
+      }
+      return false;
+    }
+  };
+}
+
+
+ResultStore::ResultStore(const std::string& storeFileName) : fileName(storeFileName) {
+}
+
+
+int ResultStore::BranchHash(const std::string& branchName) {
+  // 32-bit FNV-1a, folded to a positive index major value
+  unsigned int hash = 2166136261u;
+  for (size_t i=0; i<branchName.size(); ++i) {
+    hash ^= (unsigned char) branchName[i];
+    hash *= 16777619u;
+  }
+  return (int)(hash & 0x7fffffff);
+}
+
+
+int ResultStore::Record(const std::string& version, const std::string& inputFile, const std::string& refFile,
+                        const std::vector<BranchResult>& branchResults, std::ostream& out) {
+  TFile file(fileName.c_str(), "UPDATE");
+  if (file.IsZombie()) {
+    out<<"Error: result store "<<fileName<<" cannot be opened"<<std::endl;
+    return -1;
+  }
+
+  RunRow run;
+  ResultRow row;
+  TTree *runs = OpenTree(file, "runs", "Validation runs", RunColumns(run), true);
+  TTree *results = OpenTree(file, "results", "Per-branch validation results", ResultColumns(row), true);
+
+  run.run = (Int_t) runs->GetEntries();
+  run.time = (Long64_t) std::time(0);
+  run.firstEntry = results->GetEntries();
+  run.nBranches = (Int_t) branchResults.size();
+  CopyString(run.version, version, kNameLength);
+  CopyString(run.input, inputFile, kPathLength);
+  CopyString(run.reference, refFile, kPathLength);
+  runs->Fill();
+
+  for (size_t i=0; i<branchResults.size(); ++i) {
+    const BranchResult& result = branchResults[i];
+    row.run = run.run;
+    row.branchHash = BranchHash(result.branch);
+    CopyString(row.branch, result.branch, kNameLength);
+    row.mean = result.mean; row.meanError = result.meanError; row.std = result.std;
+    row.skewness = result.skewness; row.neff = result.neff;
+    row.refMean = result.refMean; row.refMeanError = result.refMeanError; row.refStd = result.refStd;
+    row.refSkewness = result.refSkewness; row.refNeff = result.refNeff;
+    row.ks = result.ks;
+    row.chi2 = result.chi2;
+    row.pass = result.pass;
+    results->Fill();
+  }
+
+  results->BuildIndex("branchHash", "run");
+  runs->Write("", TObject::kOverwrite);
+  results->Write("", TObject::kOverwrite);
+  file.Close();
+  return run.run;
+}
+
+
+bool ResultStore::Load(int runNumber, std::vector<BranchResult>& branchResults) const {
+  StoreReader store(fileName);
+  if (!store.IsValid()) return false;
+  if (runNumber < 0) runNumber = (int) store.runs->GetEntries() - 1;
+  if (runNumber >= store.runs->GetEntries()) return false;
+
+  store.runs->GetEntry(runNumber);
+  branchResults.clear();
+  for (Long64_t entry=store.run.firstEntry; entry<store.run.firstEntry+store.run.nBranches; ++entry) {
+    store.results->GetEntry(entry);
+    const ResultRow& row = store.row;
+    BranchResult result = BranchResult();
+    result.branch = row.branch;
+    result.mean = row.mean; result.meanError = row.meanError; result.std = row.std;
+    result.skewness = row.skewness; result.neff = row.neff;
+    result.refMean = row.refMean; result.refMeanError = row.refMeanError; result.refStd = row.refStd;
+    result.refSkewness = row.refSkewness; result.refNeff = row.refNeff;
+    result.ks = row.ks;
+    result.chi2 = row.chi2;
+    result.ad = result.adStatistic = result.wasserstein = std::nan(""); // not stored
+    result.pass = row.pass;
+    branchResults.push_back(result);
+  }
+  return true;
+}
+
+
+void ResultStore::PrintHistory(const std::string& branchName, int nRuns, std::ostream& out) const {
+  StoreReader store(fileName);
+  if (!store.IsValid()) {
+    out<<"Error: no stored results in "<<fileName<<std::endl;
+    return;
+  }
+
+  int latest = (int) store.runs->GetEntries() - 1;
+  out<<"History of branch "<<branchName<<" over the last "<<nRuns<<" runs"<<std::endl;
+  for (int runNumber=latest; runNumber>=0 && runNumber>latest-nRuns; --runNumber) {
+    bool found = store.LoadResult(branchName, runNumber);
+    store.runs->GetEntry(runNumber);
+    out<<"Run "<<runNumber<<" ("<<store.run.version<<"): ";
+    if (!found) {
+      out<<"not present"<<std::endl;
+      continue;
+    }
+    out<<"Mean: "<<store.row.mean<<" +- "<<store.row.meanError<<" ; Std: "<<store.row.std
+       <<" ; Kolmogorov: "<<store.row.ks<<" ; Chi2 test: "<<store.row.chi2
+       <<" ; "<<(store.row.pass ? "passed" : "failed")<<std::endl;
+  }
+  out<<""<<std::endl;
+}
+
+
+void ResultStore::PrintDiff(int nRuns, double alpha, std::ostream& out) const {
+  StoreReader store(fileName);
+  if (!store.IsValid()) {
+    out<<"Error: no stored results in "<<fileName<<std::endl;
+    return;
+  }
+
+  // Results of the latest run are kept in memory, previous runs go through the index
+  int latest = (int) store.runs->GetEntries() - 1;
+  store.runs->GetEntry(latest);
+  std::string latestVersion = store.run.version;
+  std::vector<ResultRow> current;
+  std::set<std::string> currentNames;
+  for (Long64_t entry=store.run.firstEntry; entry<store.run.firstEntry+store.run.nBranches; ++entry) {
+    store.results->GetEntry(entry);
+    current.push_back(store.row);
+    currentNames.insert(store.row.branch);
+  }
+
+  out<<"==== Changes of run "<<latest<<" ("<<latestVersion<<") against the last "<<nRuns<<" runs ===="<<std::endl;
+  size_t nchanged = 0;
+  for (int previous=latest-1; previous>=0 && previous>=latest-nRuns; --previous) {
+    store.runs->GetEntry(previous);
+    std::string previousVersion = store.run.version;
+    Long64_t firstEntry = store.run.firstEntry;
+    Int_t nBranches = store.run.nBranches;
+
+    for (size_t i=0; i<current.size(); ++i) {
+      const ResultRow& now = current[i];
+      std::string name = now.branch;
+      if (!store.LoadResult(name, previous)) {
+        out<<name<<": added since run "<<previous<<" ("<<previousVersion<<")"<<std::endl;
+        ++nchanged;
+        continue;
+      }
+      const ResultRow& before = store.row;
+      std::vector<std::string> changes;
+      if (now.pass != before.pass) {
+        changes.push_back(now.pass ? "tests now pass" : "tests now fail");
+      }
+      if ((now.ks < alpha) != (before.ks < alpha)) changes.push_back("Kolmogorov p-value crossed alpha");
+      if ((now.chi2 < alpha) != (before.chi2 < alpha)) changes.push_back("Chi2 p-value crossed alpha");
+      double error = std::sqrt(now.meanError*now.meanError + before.meanError*before.meanError);
+      if (error > 0 && std::fabs(now.mean - before.mean) > kMeanShiftSigma*error) {
+        changes.push_back("mean shifted by more than 3 sigma");
+      }
+      if (changes.empty()) continue;
+      ++nchanged;
+      out<<name<<": since run "<<previous<<" ("<<previousVersion<<"):";
+      for (size_t k=0; k<changes.size(); ++k) out<<(k ? ", " : " ")<<changes[k];
+      out<<std::endl;
+    }
+
+    // Branches that disappeared from the latest run
+    for (Long64_t entry=firstEntry; entry<firstEntry+nBranches; ++entry) {
+      store.results->GetEntry(entry);
+      if (currentNames.count(store.row.branch) == 0) {
+        out<<store.row.branch<<": removed since run "<<previous<<" ("<<previousVersion<<")"<<std::endl;
+        ++nchanged;
+      }
+    }
+  }
+  if (nchanged == 0) out<<"No changes"<<std::endl;
+  out<<""<<std::endl;
+}
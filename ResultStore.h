@@ -0,0 +1,43 @@
+#ifndef RESULTSTORE_H
+#define RESULTSTORE_H
+
+// Standard Library
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ComparisonSummary.h"
+
+
+// Appendable ROOT file keeping the per-branch results of every validation run.
+// A "runs" tree holds one entry per run (software version, time, files) and a
+// "results" tree one entry per branch and run, indexed on (branch hash, run)
+// so the history of a branch is found without scanning thousands of runs.
+class ResultStore {
+public:
+  explicit ResultStore(const std::string& fileName);
+
+  // Append one run; returns its run number or -1 on failure, with the error on out
+  int Record(const std::string& version, const std::string& inputFile, const std::string& refFile,
+             const std::vector<BranchResult>& results, std::ostream& out);
+
+  // Results of one stored run, the latest for a negative run number; the
+  // Anderson-Darling and Wasserstein fields are not stored and set to NaN,
+  // other fields not stored are left zero. Returns false if there is no such run.
+  bool Load(int run, std::vector<BranchResult>& results) const;
+
+  // Results of one branch over the last nRuns runs
+  void PrintHistory(const std::string& branchName, int nRuns, std::ostream& out) const;
+
+  // Branches of the latest run whose results changed with respect to any of the
+  // nRuns previous runs: verdict flips, p-values crossing alpha, shifted means,
+  // added or removed branches
+  void PrintDiff(int nRuns, double alpha, std::ostream& out) const;
+
+  static int BranchHash(const std::string& branchName);
+
+private:
+  std::string fileName;
+};
+
+#endif
@@ -0,0 +1,115 @@
+// Standard Library
+#include <sstream>
+
+#include "SchemaDiff.h"
+
+// ROOT includes
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+
+
+namespace {
+  std::string BranchType(TBranch *branch) {
+    std::string className = branch->GetClassName();
+    if (!className.empty()) return className;
+    TObjArray *leaves = branch->GetListOfLeaves();
+    int nleaves = leaves->GetEntriesFast();
+    std::ostringstream type;
+    for (int l=0; l<nleaves; ++l) {
+      TLeaf *leaf = (TLeaf*) leaves->At(l);
+      if (l > 0) type<<",";
+      if (nleaves > 1) type<<leaf->GetName()<<":";
+      type<<leaf->GetTypeName();
+      if (leaf->GetLeafCount()) type<<"["<<leaf->GetLeafCount()->GetName()<<"]";
+      else if (leaf->GetLenStatic() > 1) type<<"["<<leaf->GetLenStatic()<<"]";
+    }
+    return type.str();
+  }
+
+  const BranchSchema* Find(const std::vector<BranchSchema>& schema, const std::string& name) {
+    for (size_t i=0; i<schema.size(); ++i) {
+      if (schema[i].name == name) return &schema[i];
+    }
+    return 0;
+  }
+
+  size_t CountType(const std::vector<BranchSchema>& schema, const std::string& type) {
+    size_t n = 0;
+    for (size_t i=0; i<schema.size(); ++i) n += schema[i].type == type;
+    return n;
+  }
+}
+
+
+std::vector<BranchSchema> ReadSchema(TTree *tree) {
+  std::vector<BranchSchema> schema;
+  TIter briter(tree->GetListOfBranches());
+  TBranch *branch;
+  while( (branch=(TBranch *)briter.Next() )) {
+    BranchSchema branchSchema;
+    branchSchema.name = branch->GetName();
+    branchSchema.type = BranchType(branch);
+    schema.push_back(branchSchema);
+  }
+  return schema;
+}
+
+
+SchemaDiff DiffSchemas(TTree *tree, TTree *reftree) {
+  SchemaDiff diff;
+  diff.treeName = tree->GetName();
+  diff.entries = tree->GetEntries();
+  diff.refEntries = reftree->GetEntries();
+  std::vector<BranchSchema> schema = ReadSchema(tree);
+  std::vector<BranchSchema> refSchema = ReadSchema(reftree);
+
+  for (size_t i=0; i<schema.size(); ++i) {
+    const BranchSchema *ref = Find(refSchema, schema[i].name);
+    if (!ref) {
+      diff.inputOnly.push_back(schema[i]);
+      continue;
+    }
+    diff.common.push_back(schema[i].name);
+    if (ref->type != schema[i].type) diff.changed.push_back(std::make_pair(schema[i], *ref));
+  }
+  for (size_t i=0; i<refSchema.size(); ++i) {
+    if (!Find(schema, refSchema[i].name)) diff.referenceOnly.push_back(refSchema[i]);
+  }
+
+  // A branch gone from one side and one of the same type new on the other,
+  // neither sharing its type with another such branch, was most likely renamed
+  for (size_t i=0; i<diff.inputOnly.size(); ++i) {
+    const std::string& type = diff.inputOnly[i].type;
+    if (CountType(diff.inputOnly, type) != 1 || CountType(diff.referenceOnly, type) != 1) continue;
+    for (size_t k=0; k<diff.referenceOnly.size(); ++k) {
+      if (diff.referenceOnly[k].type == type) diff.renamed.push_back(std::make_pair(diff.inputOnly[i].name, diff.referenceOnly[k].name));
+    }
+  }
+  return diff;
+}
+
+
+void SchemaDiff::Print(std::ostream& out) const {
+  out<<"Schema of tree "<<treeName<<": "<<common.size()<<" branches in both trees";
+  if (Identical()) {
+    out<<", identical"<<std::endl;
+  }
+  else {
+    out<<", "<<inputOnly.size()<<" only in the input, "<<referenceOnly.size()<<" only in the reference, "
+       <<changed.size()<<" changed"<<std::endl;
+  }
+  if (entries != refEntries) out<<"  entries: "<<entries<<" ; reference entries: "<<refEntries<<std::endl;
+  for (size_t i=0; i<inputOnly.size(); ++i) {
+    out<<"  - "<<inputOnly[i].name<<" "<<inputOnly[i].type<<" only in the input, not compared"<<std::endl;
+  }
+  for (size_t i=0; i<referenceOnly.size(); ++i) {
+    out<<"  + "<<referenceOnly[i].name<<" "<<referenceOnly[i].type<<" only in the reference, not compared"<<std::endl;
+  }
+  for (size_t i=0; i<changed.size(); ++i) {
+    out<<"  ~ "<<changed[i].first.name<<" "<<changed[i].first.type<<" ; reference "<<changed[i].second.type<<std::endl;
+  }
+  for (size_t i=0; i<renamed.size(); ++i) {
+    out<<"  ? "<<renamed[i].first<<" possibly renamed to "<<renamed[i].second<<std::endl;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef SCHEMADIFF_H
+#define SCHEMADIFF_H
+
+// Standard Library
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Rtypes.h"
+
+class TTree;
+
+
+// Layout of one top-level branch from the tree header: the class of object
+// branches, otherwise the type and shape of every leaf, e.g. "Double_t",
+// "Float_t[4]" or "Int_t[nhits]", "x:Double_t,y:Float_t" for several leaves
+struct BranchSchema {
+  std::string name;
+  std::string type;
+};
+
+// Branches of a tree in their order, without reading any basket
+std::vector<BranchSchema> ReadSchema(TTree *tree);
+
+
+// Differences between the branches of the input and reference trees. The
+// branches in both trees, in input order, are the ones compared; those with
+// a changed type or shape are still compared, by value.
+struct SchemaDiff {
+  std::string treeName;
+  Long64_t entries;
+  Long64_t refEntries;
+  std::vector<std::string> common;
+  std::vector<BranchSchema> inputOnly;
+  std::vector<BranchSchema> referenceOnly;
+  std::vector<std::pair<BranchSchema, BranchSchema> > changed;   // input, reference
+  std::vector<std::pair<std::string, std::string> > renamed;     // input-only and reference-only branches of the same unique type
+
+  bool Identical() const { return inputOnly.empty() && referenceOnly.empty() && changed.empty(); }
+
+  // One line per difference: "-" only in the input, "+" only in the reference,
+  // "~" changed, "?" possibly renamed
+  void Print(std::ostream& out) const;
+};
+
+SchemaDiff DiffSchemas(TTree *tree, TTree *reftree);
+
+#endif
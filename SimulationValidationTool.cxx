@@ -1,220 +1,1152 @@
 // Standard Library
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+#include <climits>
+#include <cstdlib>
+#include <fnmatch.h>
+#include <unistd.h>
 
 #include "getopt_pp.h"
+#include "BranchAccumulator.h"
+#include "EventLoop.h"
+#include "Normalisation.h"
+#include "ComparisonSummary.h"
+#include "Resampling.h"
+#include "ResultStore.h"
+#include "MemoryPlan.h"
+#include "HistogramWriter.h"
+#include "ComparisonSpec.h"
+#include "Checkpoint.h"
+#include "PartialResult.h"
+#include "ParallelFill.h"
+#include "ProgressReporter.h"
+#include "SchemaDiff.h"
+#include "AccumulatorRegistry.h"
+#include "BranchFingerprint.h"
+#include "FilePool.h"
+#include "ValidationDaemon.h"
+#include "ColumnCache.h"
 
 // ROOT includes
 #include "TFile.h"
 #include "TTree.h"
 #include "TH1.h"
 #include "TBranch.h"
+#include "TKey.h"
+#include "TClass.h"
+#include "TROOT.h"
+#include "TSystem.h"
 
 
-// Global variables
-TTree *tree;
-TTree *reftree;
-std::string treeName="SimValidation";
+// Settings shared by all tree comparisons of one invocation
+struct ValidationOptions {
+  std::vector<std::string> treePatterns;
+  std::vector<std::string> branchPatterns; // all branches if empty
+  std::string weight;
+  std::string refWeight;
+  ResamplingConfig resampling;
+  int nThreads;
+  int rangeThreads; // threads reading entry ranges of one tree
+  const ComparisonSpec *spec; // binning, selection, weights and tests per branch
+  Long64_t cacheSize; // read cache per file handle, in bytes
+  double memoryBudget; // bytes of accumulators and baskets per worker, 0 for no limit
+  HistogramWriter *writer; // compared histograms are saved if set
+  CheckpointStore *checkpoints; // passes are checkpointed if set
+  bool resume; // continue from the checkpoints of an earlier run
+  bool schemaOnly; // only compare the branch layouts of the trees
+  bool skipIdentical; // branches with the same baskets in both files are not filled
+  ProgressReporter *progress; // status line on the terminal if set
+  FilePool *files; // open files kept by a daemon across runs if set
+  ColumnCache *columns; // decompressed branches are mapped from this cache if set
+  const PartialResult *binning; // shards take the binnings of automatic limits from this partial if set
+};
 
 
-void showHelp() {
-  std::cout << "SimulationValidationTool command line option(s) help" << std::endl;
-  std::cout << "\t -i , --inputFileName <ROOT FILENAME>" << std::endl;
-  std::cout << "\t -r , --referenceFileName <ROOT FILENAME>" << std::endl;
+// Files come from the pool of a daemon, kept open for its later runs, or are
+// opened for this run alone
+TFile* OpenFile(const std::string& fileName, const ValidationOptions& options) {
+  return OpenFile(fileName, options.files);
 }
 
+void CloseFile(TFile *file, const ValidationOptions& options) {
+  CloseFile(file, options.files);
+}
 
-int main(int argc, char **argv) {
-  void ParseRootFile(std::string rootFileName, std::string refFileName);
+
+void showHelp(std::ostream& out) {
+  out << "SimulationValidationTool command line option(s) help" << std::endl;
+  out << "\t -i , --inputFileName <ROOT FILENAME>" << std::endl;
+  out << "\t -r , --referenceFileName <ROOT FILENAME>" << std::endl;
+  out << "\t -t , --tree <NAME OR PATTERN> ... trees to compare, shell wildcards allowed (default: SimValidation)" << std::endl;
+  out << "\t -b , --branch <NAME OR PATTERN> ... only compare these branches, also as <tree>/<branch> (default: all)" << std::endl;
+  out << "\t --histograms compare all TH1 and TH2 histograms of both files, paired by path, instead of trees" << std::endl;
+  out << "\t --schemaOnly only report the branches added, removed or changed in each tree, without reading any entry" << std::endl;
+  out << "\t --skipIdentical report branches holding the same values in both files as identical instead of comparing them" << std::endl;
+  out << "\t --cacheSize <MB> read cache per file, used by one tree at a time (default: 64)" << std::endl;
+  out << "\t --columnCache <DIRECTORY> keep the decompressed values of plain branches in this directory for later runs over the same files" << std::endl;
+  out << "\t --columnCacheSize <MB> size the column cache is trimmed to, least recently used columns first (default: 4096)" << std::endl;
+  out << "\t -w , --weight <BRANCH OR EXPRESSION> per-event weight of the input file" << std::endl;
+  out << "\t --refWeight <BRANCH OR EXPRESSION> per-event weight of the reference file (default: --weight)" << std::endl;
+  out << "\t --spec <FILENAME> binning, range, selection, weights and tests per branch or branch pattern" << std::endl;
+  out << "\t --correction <bonferroni|holm|bh> multiple-comparison correction of the summary (default: holm)" << std::endl;
+  out << "\t --alpha <SIGNIFICANCE> significance level of the summary (default: 0.05)" << std::endl;
+  out << "\t --top <N> number of most discrepant branches listed in the summary (default: 10)" << std::endl;
+  out << "\t --resample <N> bootstrap KS and Chi2 p-values from N resamples of the filled histograms (default: 0, off)" << std::endl;
+  out << "\t --resampleTime <SECONDS> time budget of the resampling per branch (default: 0, no limit)" << std::endl;
+  out << "\t --seed <SEED> random seed of the resampling (default: 4357)" << std::endl;
+  out << "\t -j , --threads <N> number of worker threads (default: 1)" << std::endl;
+  out << "\t --memoryBudget <MB> compare branches in as few passes as fit in this much memory (default: 0, one pass)" << std::endl;
+  out << "\t --save <ROOT FILENAME> write the input, reference, ratio and pull histograms of every branch to a file" << std::endl;
+  out << "\t --plots <DIRECTORY> with --save, also draw input and reference of every branch into PNG files" << std::endl;
+  out << "\t --checkpoint <DIRECTORY> periodically save the partially filled branches of every pass to this directory" << std::endl;
+  out << "\t --checkpointInterval <SECONDS> time between two checkpoints of a pass (default: 300)" << std::endl;
+  out << "\t --resume continue an interrupted comparison from the checkpoints in the --checkpoint directory" << std::endl;
+  out << "\t --fillOnly <FILENAME> fill the branches of one shard, given with -i or -r, into a partial result file" << std::endl;
+  out << "\t --binningFrom <FILENAME> with --fillOnly, bin branches with automatic limits as in this partial result, e.g. of the first input shard" << std::endl;
+  out << "\t --merge <FILENAME> ... merge partial results of input and reference shards and compare them" << std::endl;
+  out << "\t --noProgress no status line while reading trees (only shown when stderr is a terminal)" << std::endl;
+  out << "\t --store <ROOT FILENAME> append the per-branch results of this run to a result store" << std::endl;
+  out << "\t --version <TAG> software version the run is recorded under (default: unknown)" << std::endl;
+  out << "\t --diff report branches of the latest stored run that changed against the previous runs" << std::endl;
+  out << "\t --query <BRANCH> print the stored history of one branch" << std::endl;
+  out << "\t --history <N> number of stored runs looked at by --diff and --query (default: 5)" << std::endl;
+  out << "\t --serve <SOCKET> run as a daemon on this Unix socket, running requests on -j worker threads with the files kept open" << std::endl;
+  out << "\t --daemon <SOCKET> run in the daemon on this socket if one listens, otherwise in this process (default: $SVT_DAEMON_SOCKET)" << std::endl;
+  out << "\t --stopDaemon with --daemon, stop the daemon once its queued requests are done" << std::endl;
+  out << "\t @<FILENAME> read further options from a file" << std::endl;
+}
+
+
+// One invocation of the tool with its command line arguments, without the
+// program name. Output goes to out and the branch results are returned, so a
+// daemon runs requests alike; files come from its pool if given.
+int RunTool(const std::vector<std::string>& args, std::ostream& out, FilePool *files, std::vector<BranchResult>& results) {
+  void ParseRootFile(std::string rootFileName, std::string refFileName, const ValidationOptions& options, ComparisonSummary& summary, std::ostream& out);
+  void CompareHistogramFiles(std::string rootFileName, std::string refFileName, const ValidationOptions& options, ComparisonSummary& summary, std::ostream& out);
+  bool FillPartial(std::string shardFileName, bool reference, std::string partialFileName, const ValidationOptions& options, std::ostream& out);
+  void ComparePartials(const std::vector<std::string>& partialFileNames, const ValidationOptions& options, ComparisonSummary& summary, std::string& inputSources, std::string& refSources, std::ostream& out);
   std::string inputFileName;
   std::string refFileName;
+  ValidationOptions options;
+  int cacheSizeMB;
+  std::string columnCacheDirectory;
+  int columnCacheSizeMB;
+  int memoryBudgetMB;
+  std::string correction;
+  double alpha;
+  int nWorst;
+  std::string specFileName;
+  std::string saveFileName;
+  std::string plotDirectory;
+  std::string checkpointDirectory;
+  std::string fillOnlyFileName;
+  std::string binningFileName;
+  std::vector<std::string> partialFileNames;
+  double checkpointInterval;
+  std::string storeFileName;
+  std::string version;
+  std::string queryBranch;
+  int nHistory;
 
-  GetOpt::GetOpt_pp ops(argc, argv);
+  std::vector<const char*> argv(1, "SimulationValidationTool");
+  for (size_t i=0; i<args.size(); ++i) argv.push_back(args[i].c_str());
+  GetOpt::GetOpt_pp ops((int) argv.size(), &argv[0]);
 
   // Check for help request
   if (ops >> GetOpt::OptionPresent('h', "help")) {
-    showHelp();
+    showHelp(out);
     return 0;
   }
   
   ops >> GetOpt::Option('i', "inputFile", inputFileName, "");
   ops >> GetOpt::Option('r', "refFile", refFileName, "");
+  ops >> GetOpt::Option('t', "tree", options.treePatterns);
+  ops >> GetOpt::Option('b', "branch", options.branchPatterns);
+  ops >> GetOpt::Option("cacheSize", cacheSizeMB, 64);
+  ops >> GetOpt::Option("columnCache", columnCacheDirectory, "");
+  ops >> GetOpt::Option("columnCacheSize", columnCacheSizeMB, 4096);
+  ops >> GetOpt::Option('w', "weight", options.weight, "");
+  ops >> GetOpt::Option("refWeight", options.refWeight, options.weight);
+  ops >> GetOpt::Option("spec", specFileName, "");
+  ops >> GetOpt::Option("correction", correction, "holm");
+  ops >> GetOpt::Option("alpha", alpha, 0.05);
+  ops >> GetOpt::Option("top", nWorst, 10);
+  ops >> GetOpt::Option("resample", options.resampling.nResamples, 0);
+  ops >> GetOpt::Option("resampleTime", options.resampling.timeBudget, 0.0);
+  ops >> GetOpt::Option("seed", options.resampling.seed, 4357UL);
+  ops >> GetOpt::Option('j', "threads", options.nThreads, 1);
+  ops >> GetOpt::Option("memoryBudget", memoryBudgetMB, 0);
+  if (options.treePatterns.empty()) options.treePatterns.push_back("SimValidation");
+  if (options.nThreads < 1) options.nThreads = 1;
+  options.rangeThreads = 1;
+  options.resampling.nThreads = options.nThreads;
+  options.cacheSize = (Long64_t) cacheSizeMB*1024*1024;
+  options.memoryBudget = (memoryBudgetMB > 0) ? memoryBudgetMB*1024.0*1024.0 : 0;
+  ops >> GetOpt::Option("save", saveFileName, "");
+  ops >> GetOpt::Option("plots", plotDirectory, "");
+  ops >> GetOpt::Option("checkpoint", checkpointDirectory, "");
+  ops >> GetOpt::Option("checkpointInterval", checkpointInterval, 300.0);
+  options.resume = ops >> GetOpt::OptionPresent("resume");
+  ops >> GetOpt::Option("fillOnly", fillOnlyFileName, "");
+  ops >> GetOpt::Option("binningFrom", binningFileName, "");
+  ops >> GetOpt::Option("merge", partialFileNames);
+  ops >> GetOpt::Option("store", storeFileName, "");
+  ops >> GetOpt::Option("version", version, "unknown");
+  ops >> GetOpt::Option("query", queryBranch, "");
+  ops >> GetOpt::Option("history", nHistory, 5);
+  bool diff = ops >> GetOpt::OptionPresent("diff");
+  bool histogramMode = ops >> GetOpt::OptionPresent("histograms");
+  bool noProgress = ops >> GetOpt::OptionPresent("noProgress");
+  options.schemaOnly = ops >> GetOpt::OptionPresent("schemaOnly");
+  options.skipIdentical = ops >> GetOpt::OptionPresent("skipIdentical");
+
+  // Queries of the result store alone do not need any input
+  bool storeOnly = !storeFileName.empty() && (diff || !queryBranch.empty())
+    && inputFileName.empty() && refFileName.empty();
+  if (storeOnly) {
+    ResultStore store(storeFileName);
+    if (diff) store.PrintDiff(nHistory, alpha, out);
+    if (!queryBranch.empty()) store.PrintHistory(queryBranch, nHistory, out);
+    return 1;
+  }
+
+  // A fill-only run reads one shard, a merge run only partial results
+  bool missingInput = inputFileName.empty() || refFileName.empty();
+  if (!fillOnlyFileName.empty()) missingInput = inputFileName.empty() == refFileName.empty();
+  if (!partialFileNames.empty()) missingInput = false;
+  if (missingInput) {
+    out << "Missing file name input." << std::endl;
+    showHelp(out);
+    return 0;
+  }
+
+  ComparisonSummary::Correction method;
+  if (!ComparisonSummary::ParseCorrection(correction, method)) {
+    out << "Unknown correction " << correction << std::endl;
+    showHelp(out);
+    return 0;
+  }
+  ComparisonSummary summary(method, alpha, nWorst > 0 ? nWorst : 0);
+
+  // The spec is read once; command line weights are its defaults
+  BranchSpec defaults;
+  defaults.weight = options.weight;
+  defaults.refWeight = options.refWeight;
+  ComparisonSpec spec(defaults);
+  if (!specFileName.empty() && !spec.Parse(specFileName, out)) return 0;
+  options.spec = &spec;
 
-  if (inputFileName.empty() || refFileName.empty()) {
-    std::cout << "Missing file name input." << std::endl;
-    showHelp();
+  // Runs reading trees report their progress on an interactive terminal
+  bool showProgress = !noProgress && !histogramMode && !options.schemaOnly && partialFileNames.empty() && &out == &std::cout && ProgressReporter::Interactive();
+  options.progress = 0;
+  options.files = files;
+  options.columns = 0;
+  options.binning = 0;
+
+  // Shards are only filled here, the comparison is made by a later --merge
+  if (!fillOnlyFileName.empty()) {
+    bool reference = inputFileName.empty();
+    PartialResult *binning = 0;
+    if (!binningFileName.empty()) {
+      binning = PartialResult::Read(binningFileName, out, options.branchPatterns);
+      if (!binning) {
+        out << "Error: partial result " << binningFileName << " for --binningFrom cannot be read" << std::endl;
+        return 0;
+      }
+      binning->FixBinnings();
+      options.binning = binning;
+    }
+    if (showProgress) options.progress = new ProgressReporter;
+    bool filled = FillPartial(reference ? refFileName : inputFileName, reference, fillOnlyFileName, options, out);
+    delete options.progress;
+    delete binning;
+    return filled ? 1 : 0;
+  }
+
+  // Histograms are saved by a writer thread while the comparison goes on
+  options.writer = 0;
+  if (!saveFileName.empty()) {
+    options.writer = new HistogramWriter(saveFileName, plotDirectory, out);
+    if (!options.writer->IsOpen()) {
+      delete options.writer;
+      return 0;
+    }
+  }
+  
+  // Tree passes are checkpointed; histogram files are compared in one go
+  options.checkpoints = 0;
+  if (options.resume && checkpointDirectory.empty()) {
+    out << "Error: --resume needs the --checkpoint directory of the interrupted run" << std::endl;
+    delete options.writer;
     return 0;
   }
+  if (!checkpointDirectory.empty() && !histogramMode && partialFileNames.empty()) {
+    gSystem->mkdir(checkpointDirectory.c_str(), kTRUE);
+    options.checkpoints = new CheckpointStore(checkpointDirectory, inputFileName, refFileName, checkpointInterval);
+  }
+
+  // Trees are read from the column cache, built on their first comparison
+  if (!columnCacheDirectory.empty() && !histogramMode && partialFileNames.empty()) {
+    gSystem->mkdir(columnCacheDirectory.c_str(), kTRUE);
+    options.columns = new ColumnCache(columnCacheDirectory, columnCacheSizeMB*1024.0*1024.0);
+  }
   
   // Call Function
-  ParseRootFile(inputFileName, refFileName);
+  if (showProgress) options.progress = new ProgressReporter;
+  if (!partialFileNames.empty()) ComparePartials(partialFileNames, options, summary, inputFileName, refFileName, out);
+  else if (histogramMode) CompareHistogramFiles(inputFileName, refFileName, options, summary, out);
+  else ParseRootFile(inputFileName, refFileName, options, summary, out);
+  delete options.progress; // clears the status line
+  delete options.columns;
+  if (options.checkpoints) {
+    options.checkpoints->RemoveAll(); // the comparison completed
+    delete options.checkpoints;
+  }
+  if (options.writer) {
+    delete options.writer; // writes what is still queued
+    out<<"Histograms saved in "<<saveFileName<<std::endl;
+  }
+  summary.Print(out);
+  results = summary.GetResults();
+
+  if (options.memoryBudget > 0) {
+    double peak = PeakResidentMemory()/(1024*1024);
+    out<<"Peak memory use: "<<peak<<" MB of a "<<memoryBudgetMB<<" MB budget"<<std::endl;
+    if (peak > memoryBudgetMB) out<<"WARNING: peak memory use exceeded the memory budget"<<std::endl;
+  }
+
+  if (!storeFileName.empty()) {
+    ResultStore store(storeFileName);
+    int run = store.Record(version, inputFileName, refFileName, summary.GetResults(), out);
+    if (run >= 0) out<<"Results stored as run "<<run<<" in "<<storeFileName<<std::endl;
+    if (diff) store.PrintDiff(nHistory, alpha, out);
+    if (!queryBranch.empty()) store.PrintHistory(queryBranch, nHistory, out);
+  }
   return 1;
 }
 
 
 
-void ParseRootFile(std::string rootFileName, std::string refFileName) {
-  void CompareHistogram(std::string branchName);
+// Arguments sent to a daemon: without --daemon, and with the names of files
+// and directories made absolute, as the daemon runs in its own directory
+std::vector<std::string> DaemonArguments(const std::vector<std::string>& args) {
+  const char *pathOptions[] = {"-i", "--inputFile", "-r", "--refFile", "--spec", "--save", "--plots", "--checkpoint", "--fillOnly", "--binningFrom", "--store", "--merge", "--columnCache"};
+  const size_t npathOptions = sizeof(pathOptions)/sizeof(pathOptions[0]);
+  char directory[PATH_MAX];
+  std::string cwd = getcwd(directory, sizeof(directory)) ? directory : "";
+  std::vector<std::string> sent;
+  bool pathValue = false; // the next value is a path
+  bool pathValues = false; // all values up to the next option are paths
+  for (size_t i=0; i<args.size(); ++i) {
+    std::string arg = args[i];
+    if (arg == "--daemon") {
+      ++i;
+      continue;
+    }
+    if (arg.size() > 1 && arg[0] == '-') {
+      pathValue = std::find(pathOptions, pathOptions + npathOptions, arg) != pathOptions + npathOptions;
+      pathValues = arg == "--merge";
+    }
+    else {
+      if (arg.size() > 1 && arg[0] == '@' && arg[1] != '/') arg = "@" + cwd + "/" + arg.substr(1);
+      else if ((pathValue || pathValues) && !arg.empty() && arg[0] != '/') arg = cwd + "/" + arg;
+      pathValue = false;
+    }
+    sent.push_back(arg);
+  }
+  return sent;
+}
+
+
+int main(int argc, char **argv) {
+  int RunTool(const std::vector<std::string>& args, std::ostream& out, FilePool *files, std::vector<BranchResult>& results);
+  std::vector<std::string> args(argv + 1, argv + argc);
+  std::string serveSocket;
+  std::string daemonSocket;
+  int nThreads;
+  const char *defaultSocket = getenv("SVT_DAEMON_SOCKET");
+
+  GetOpt::GetOpt_pp ops(argc, argv);
+  ops >> GetOpt::Option("serve", serveSocket, "");
+  ops >> GetOpt::Option("daemon", daemonSocket, std::string(defaultSocket ? defaultSocket : ""));
+  ops >> GetOpt::Option('j', "threads", nThreads, 1);
+  bool stopDaemon = ops >> GetOpt::OptionPresent("stopDaemon");
+
+  // Daemon: ROOT is set up once, every request is a run of the tool
+  if (!serveSocket.empty()) {
+    ROOT::EnableThreadSafety();
+    ValidationDaemon daemon(serveSocket, nThreads, &RunTool);
+    return daemon.Serve(std::cout) ? 1 : 0;
+  }
+
+  // Thin client of a running daemon, or a run in this process when none listens
+  if (!daemonSocket.empty()) {
+    int connection = ConnectToDaemon(daemonSocket);
+    if (stopDaemon) {
+      bool stopped = connection >= 0 && StopDaemon(connection);
+      if (stopped) std::cout<<"Daemon on "<<daemonSocket<<" stopping"<<std::endl;
+      else std::cout<<"WARNING: no daemon listening on "<<daemonSocket<<std::endl;
+      return stopped ? 1 : 0;
+    }
+    if (connection >= 0) {
+      DaemonReply reply;
+      if (RunInDaemon(connection, DaemonArguments(args), reply)) {
+        std::cout<<reply.output<<std::flush;
+        return reply.status;
+      }
+      std::cout<<"Error: the daemon on "<<daemonSocket<<" stopped before replying"<<std::endl;
+      return 0;
+    }
+    std::cout<<"WARNING: no daemon listening on "<<daemonSocket<<", running in this process"<<std::endl;
+  }
+
+  std::vector<BranchResult> results;
+  return RunTool(args, std::cout, 0, results);
+}
+
+
+
+// Per-tree output and results, kept apart while trees are compared in parallel
+struct TreeJob {
+  std::string treeName;
+  std::string prefix; // prepended to branch names when several trees are compared
+  std::ostringstream out;
+  ComparisonSummary summary;
 
-  // Check the input root file can be opened and contains a tree with the right name
-  std::cout<<"Processing "<<rootFileName<<std::endl;
+  TreeJob(const std::string& name, const std::string& branchPrefix, const ComparisonSummary& settings)
+    : treeName(name), prefix(branchPrefix), summary(settings) {}
+};
+
+
+// Class of a key from the dictionaries already linked in. Other classes stored
+// in the file are not autoloaded, which would start up the interpreter.
+TClass* KeyClass(TKey *key) {
+  return TClass::GetClass(key->GetClassName(), kFALSE, kTRUE);
+}
+
+
+// Names of all trees in the top directory of the file matching any of the patterns
+std::vector<std::string> FindTrees(TFile *file, const std::vector<std::string>& patterns) {
+  std::vector<std::string> treeNames;
+  for (size_t p=0; p<patterns.size(); ++p) {
+    TIter keyiter(file->GetListOfKeys());
+    TKey *key;
+    while ( (key=(TKey *)keyiter.Next()) ) {
+      std::string name = key->GetName();
+      TClass *cl = KeyClass(key);
+      if (!cl || !cl->InheritsFrom("TTree")) continue;
+      if (fnmatch(patterns[p].c_str(), name.c_str(), 0) != 0) continue;
+      bool known = false;
+      for (size_t i=0; i<treeNames.size(); ++i) known = known || treeNames[i] == name;
+      if (!known) treeNames.push_back(name);
+    }
+  }
+  return treeNames;
+}
+
+
+// Compare the tree jobs handed out by nextJob. Each worker reads through its
+// own file handles, opened once; null files are opened on the first job.
+void CompareTreeJobs(std::string rootFileName, std::string refFileName, TFile *rootFile, TFile *refFile,
+                     const std::vector<TreeJob*>& jobs, std::atomic<size_t>& nextJob,
+                     const ValidationOptions& options, bool buffered, std::ostream& out) {
+  void CompareTree(TTree *tree, TTree *reftree, const std::string& prefix, const ValidationOptions& options, ComparisonSummary& summary, std::ostream& out);
+  bool ownFiles = false;
+  size_t j;
+  while ( (j = nextJob++) < jobs.size() ) {
+    TreeJob *job = jobs[j];
+    std::ostream& treeOut = buffered ? job->out : out;
+    if (!rootFile) {
+      rootFile = OpenFile(rootFileName, options);
+      refFile = OpenFile(refFileName, options);
+      ownFiles = true;
+    }
+
+    TTree *tree = (TTree*) rootFile->Get(job->treeName.c_str());
+    TTree *reftree = (TTree*) refFile->Get(job->treeName.c_str());
+    if (tree==0) {
+      treeOut<<"Error: no data in a tree named "<<job->treeName<<std::endl;
+      continue;
+    }
+    if (reftree==0) {
+      treeOut<<"WARNING: no reference data in a tree named "<<job->treeName<<" found in "<<refFileName<<". To generate statistics, provide a valid reference ROOT file."<<std::endl;
+      delete tree;
+      continue;
+    }
+
+    // Only one tree per file handle is read at a time, it gets the whole cache of the file
+    tree->SetCacheSize(options.cacheSize);
+    tree->AddBranchToCache("*", kTRUE);
+    reftree->SetCacheSize(options.cacheSize);
+    reftree->AddBranchToCache("*", kTRUE);
+
+    CompareTree(tree, reftree, job->prefix, options, job->summary, treeOut);
+
+    // Release the baskets and caches before the next tree
+    delete reftree;
+    delete tree;
+  }
+  if (ownFiles) {
+    CloseFile(refFile, options);
+    CloseFile(rootFile, options);
+  }
+}
+
+
+void ParseRootFile(std::string rootFileName, std::string refFileName, const ValidationOptions& options, ComparisonSummary& summary, std::ostream& out) {
+  // Check the input root file can be opened and contains trees with the right names
+  out<<"Processing "<<rootFileName<<std::endl;
   TFile *rootFile;
-  rootFile = new TFile(rootFileName.c_str());
+  rootFile = OpenFile(rootFileName, options);
   if (rootFile->IsZombie()) {
-    std::cout<<"Error: file "<<rootFileName<<" not found"<<std::endl;
+    out<<"Error: file "<<rootFileName<<" not found"<<std::endl;
+    CloseFile(rootFile, options);
     return;
   }
-  
-  tree = (TTree*) rootFile->Get(treeName.c_str());
-  
-  // Check if it found the tree
-  if (tree==0) {
-    std::cout<<"Error: no data in a tree named "<<treeName<<std::endl;
-    rootFile->Close();
+
+  std::vector<std::string> treeNames = FindTrees(rootFile, options.treePatterns);
+
+  // Check if it found the trees
+  if (treeNames.empty()) {
+    out<<"Error: no data in a tree named";
+    for (size_t p=0; p<options.treePatterns.size(); ++p) out<<" "<<options.treePatterns[p];
+    out<<std::endl;
+    CloseFile(rootFile, options);
     return;
   }
-    
+
   // Check for a reference file
   TFile *refFile;
-  refFile = new TFile(refFileName.c_str());
+  refFile = OpenFile(refFileName, options);
   if (refFile->IsZombie()) {
-    std::cout << "WARNING: No valid reference ROOT file given." << std::endl;
+    out << "WARNING: No valid reference ROOT file given." << std::endl;
+    CloseFile(refFile, options);
+    CloseFile(rootFile, options);
     return;
   }
-  else {
-    reftree = (TTree*) refFile->Get(treeName.c_str());
-    // Check if it found the tree
-    if (reftree==0) {
-      std::cout<<"WARNING: no reference data in a tree named "<<treeName<<" found in "<<refFileName<<". To generate statistics, provide a valid reference ROOT file."<<std::endl;
-      refFile->Close();
-      rootFile->Close();
-      return;
+
+  // One job per tree; branch names are qualified once there is more than one tree
+  std::vector<TreeJob*> jobs;
+  for (size_t i=0; i<treeNames.size(); ++i) {
+    std::string prefix = (treeNames.size() > 1) ? treeNames[i]+"/" : "";
+    jobs.push_back(new TreeJob(treeNames[i], prefix, summary));
+  }
+
+  // Trees are scheduled over the worker threads, the calling thread reuses the open files
+  // Threads left over read entry ranges within the trees, unless checkpointed
+  // by entry
+  int nworkers = std::min((int)jobs.size(), options.nThreads);
+  bool buffered = nworkers > 1;
+  ValidationOptions workerOptions = options;
+  workerOptions.rangeThreads = options.checkpoints ? 1 : options.nThreads/nworkers;
+  if (buffered || workerOptions.rangeThreads > 1) ROOT::EnableThreadSafety();
+
+  // The memory budget is shared by all threads, after what is in use already
+  // and the read caches of their two file handles
+  if (options.memoryBudget > 0) {
+    double available = options.memoryBudget - CurrentResidentMemory();
+    workerOptions.memoryBudget = available/(nworkers*workerOptions.rangeThreads) - 2.0*options.cacheSize;
+    if (workerOptions.memoryBudget <= 0) {
+      out<<"WARNING: memory budget already used up before reading, comparing one branch per pass"<<std::endl;
+      workerOptions.memoryBudget = 1;
     }
   }
-    
-  // Get a list of all the branches in the main tree
-  TObjArray* branches = tree->GetListOfBranches();
-  TIter briter(branches);
-  TBranch *branch;
-  
-  std::cout<<""<<std::endl;
-  std::cout<<"Statistics on branches"<<std::endl;
-  std::cout<<""<<std::endl;
-  
-  // Loop through Branches
-  while( (branch=(TBranch *)briter.Next() )) {
-    std::string branchName=branch->GetName();
-    // Call Function
-    CompareHistogram(branchName); 
+
+  // One pass over every tree is expected, more are added as the passes are planned
+  if (options.progress) {
+    for (size_t i=0; i<jobs.size(); ++i) {
+      TTree *tree = (TTree*) rootFile->Get(jobs[i]->treeName.c_str());
+      TTree *reftree = (TTree*) refFile->Get(jobs[i]->treeName.c_str());
+      if (tree && reftree) options.progress->AddWork(tree->GetEntries() + reftree->GetEntries());
+      delete reftree;
+      delete tree;
+    }
+  }
+
+  std::atomic<size_t> nextJob(0);
+  std::vector<std::thread> workers;
+  for (int w=1; w<nworkers; ++w) {
+    workers.push_back(std::thread(CompareTreeJobs, rootFileName, refFileName, (TFile*)0, (TFile*)0,
+                                  std::cref(jobs), std::ref(nextJob), std::cref(workerOptions), buffered, std::ref(out)));
+  }
+  CompareTreeJobs(rootFileName, refFileName, rootFile, refFile, jobs, nextJob, workerOptions, buffered, out);
+  for (size_t w=0; w<workers.size(); ++w) workers[w].join();
+
+  // Output and results in tree order, whichever thread compared them
+  for (size_t i=0; i<jobs.size(); ++i) {
+    if (buffered) out<<jobs[i]->out.str();
+    summary.Merge(jobs[i]->summary);
+    delete jobs[i];
   }
-  refFile->Close();
-  rootFile->Close();
+  CloseFile(refFile, options);
+  CloseFile(rootFile, options);
 }
 
-void CompareHistogram(std::string branchName) {
-  int nbins=100;
-  double lowLimit = 0;
-  double highLimit = -9999;
-  std::string title="";
-  
-  // Check whether the reference file contains this branch
-  bool hasReferenceBranch = reftree->GetBranchStatus(branchName.c_str());
-  if (!hasReferenceBranch) {
-    std::cout<<"WARNING: branch "<<branchName<<" not found in reference file. No comparison statistics will be made for this branch"<<std::endl;
+
+// Paths of all TH1 and TH2 objects below dir, recursing into subdirectories
+void CollectHistograms(TDirectory *dir, const std::string& path, std::vector<std::string>& paths) {
+  TIter keyiter(dir->GetListOfKeys());
+  TKey *key;
+  while ( (key=(TKey *)keyiter.Next()) ) {
+    std::string name = path + key->GetName();
+    TClass *cl = KeyClass(key);
+    if (!cl) continue;
+    if (cl->InheritsFrom("TDirectory")) {
+      TDirectory *subdir = dir->GetDirectory(key->GetName());
+      if (subdir) CollectHistograms(subdir, name + "/", paths);
+      continue;
+    }
+    if (!cl->InheritsFrom("TH1") || cl->InheritsFrom("TH3")) continue;
+    bool known = false; // keep only the highest cycle
+    for (size_t i=0; i<paths.size(); ++i) known = known || paths[i] == name;
+    if (!known) paths.push_back(name);
+  }
+}
+
+
+// Compare pre-filled histograms paired by their path in both files
+void CompareHistogramFiles(std::string rootFileName, std::string refFileName, const ValidationOptions& options, ComparisonSummary& summary, std::ostream& out) {
+  void CompareHistogram(std::string branchName, BranchAccumulator *acc, BranchAccumulator *refacc, const Normalisation& norm, const BranchSpec& spec, const ValidationOptions& options, unsigned long streamId, ComparisonSummary& summary, std::ostream& out);
+
+  out<<"Processing histograms in "<<rootFileName<<std::endl;
+  TFile *rootFile;
+  rootFile = OpenFile(rootFileName, options);
+  if (rootFile->IsZombie()) {
+    out<<"Error: file "<<rootFileName<<" not found"<<std::endl;
+    CloseFile(rootFile, options);
     return;
   }
+  TFile *refFile;
+  refFile = OpenFile(refFileName, options);
+  if (refFile->IsZombie()) {
+    out << "WARNING: No valid reference ROOT file given." << std::endl;
+    CloseFile(refFile, options);
+    CloseFile(rootFile, options);
+    return;
+  }
+
+  std::vector<std::string> paths;
+  CollectHistograms(rootFile, "", paths);
+
+  out<<""<<std::endl;
+  out<<"Statistics on histograms"<<std::endl;
+  out<<""<<std::endl;
+
+  for (size_t i=0; i<paths.size(); ++i) {
+    TH1 *h = (TH1*) rootFile->Get(paths[i].c_str());
+    TH1 *href = (TH1*) refFile->Get(paths[i].c_str());
+    if (!href || !href->InheritsFrom("TH1")) {
+      out<<"WARNING: histogram "<<paths[i]<<" not found in reference file. No comparison statistics will be made for this histogram"<<std::endl;
+      delete h;
+      continue;
+    }
+    h->SetDirectory(0);
+    href->SetDirectory(0);
+
+    // The tests need identical binning
+    bool sameBinning = h->GetDimension() == href->GetDimension() && h->GetNcells() == href->GetNcells()
+      && h->GetXaxis()->GetXmin() == href->GetXaxis()->GetXmin() && h->GetXaxis()->GetXmax() == href->GetXaxis()->GetXmax();
+    if (sameBinning && h->GetDimension() > 1) {
+      sameBinning = h->GetYaxis()->GetXmin() == href->GetYaxis()->GetXmin() && h->GetYaxis()->GetXmax() == href->GetYaxis()->GetXmax();
+    }
+    if (!sameBinning) {
+      out<<"WARNING: histogram "<<paths[i]<<" has a different binning in the reference file. No comparison statistics will be made for this histogram"<<std::endl;
+      delete h;
+      delete href;
+      continue;
+    }
+
+    // Moments come from the histogram statistics, along x for TH2
+    BranchAccumulator acc(h, 1);
+    BranchAccumulator refacc(href, 1);
+    bool weighted = acc.GetEffectiveEntries() != acc.GetEntries() || refacc.GetEffectiveEntries() != refacc.GetEntries();
+    Normalisation norm((Long64_t) acc.GetEntries(), (Long64_t) refacc.GetEntries(), weighted);
+    CompareHistogram(paths[i], &acc, &refacc, norm, options.spec->Resolve(paths[i], paths[i]), options, ResultStore::BranchHash(paths[i]), summary, out);
+  }
+  CloseFile(refFile, options);
+  CloseFile(rootFile, options);
+}
+
+
+// Fill all branches of the selected trees of one shard, input or reference,
+// into a partial result. Selections, weights and fixed ranges come from the
+// spec; automatic limits are set by each shard alone unless the shards take
+// them from the partial of the first one (--binningFrom), so only then are all
+// shards of such a branch binned alike.
+bool FillPartial(std::string shardFileName, bool reference, std::string partialFileName, const ValidationOptions& options, std::ostream& out) {
+  out<<"Filling "<<(reference ? "reference" : "input")<<" shard "<<shardFileName<<std::endl;
+  TFile *shardFile;
+  shardFile = OpenFile(shardFileName, options);
+  if (shardFile->IsZombie()) {
+    out<<"Error: file "<<shardFileName<<" not found"<<std::endl;
+    CloseFile(shardFile, options);
+    return false;
+  }
+
+  std::vector<std::string> treeNames = FindTrees(shardFile, options.treePatterns);
+  if (treeNames.empty()) {
+    out<<"Error: no data in a tree named";
+    for (size_t p=0; p<options.treePatterns.size(); ++p) out<<" "<<options.treePatterns[p];
+    out<<std::endl;
+    CloseFile(shardFile, options);
+    return false;
+  }
+
+  PartialResult partial(reference ? PartialResult::kReference : PartialResult::kInput);
+  partial.AddSource(shardFileName);
+  bool filled = true;
+  for (size_t t=0; filled && t<treeNames.size(); ++t) {
+    TTree *tree = (TTree*) shardFile->Get(treeNames[t].c_str());
+    tree->SetCacheSize(options.cacheSize);
+    tree->AddBranchToCache("*", kTRUE);
+
+    std::vector<std::string> branchNames;
+    std::vector<BranchAccumulator*> accumulators;
+    std::vector<FillCondition> conditions;
+    TIter briter(tree->GetListOfBranches());
+    TBranch *branch;
+    while( (branch=(TBranch *)briter.Next() )) {
+      std::string branchName = branch->GetName();
+      if (!MatchesBranch(options.branchPatterns, treeNames[t], branchName)) continue;
+      BranchSpec spec = options.spec->Resolve(branchName, treeNames[t]+"/"+branchName);
+      branchNames.push_back(branchName);
+      AccumulatorRegistry::Role role = reference ? AccumulatorRegistry::kReference : AccumulatorRegistry::kInput;
+      std::string histName = AccumulatorRegistry::HistogramName(role, branchName);
+      // Automatic limits are shared with the binning partial, so all shards merge bin by bin
+      const BranchAccumulator *binning = 0;
+      if (options.binning && spec.lowLimit >= spec.highLimit) {
+        binning = options.binning->Find(treeNames[t], branchName);
+        if (!binning) out<<"WARNING: branch "<<treeNames[t]<<"/"<<branchName<<" not in the --binningFrom partial result, binned from this shard alone"<<std::endl;
+      }
+      if (binning) accumulators.push_back(new BranchAccumulator(histName, *binning));
+      else accumulators.push_back(new BranchAccumulator(histName, spec.nbins, spec.lowLimit, spec.highLimit));
+      conditions.push_back(FillCondition(spec.selection, reference ? spec.refWeight : spec.weight));
+    }
+
+    // Left unfinalised, so the shards merge as if filled in one pass
+    std::atomic<Long64_t> *entriesRead = 0;
+    if (options.progress) {
+      options.progress->AddWork(tree->GetEntries());
+      entriesRead = options.progress->GetEntryCounter();
+    }
+    filled = FillAccumulators(tree, branchNames, accumulators, conditions, out, 0, 0, false, -1, entriesRead);
+    for (size_t i=0; i<accumulators.size(); ++i) accumulators[i]->FixBinning(); // as a later --binningFrom sees it
+    partial.AddTree(treeNames[t], tree->GetEntries(), branchNames, accumulators);
+    delete tree;
+  }
+  CloseFile(shardFile, options);
+
+  if (!filled || !partial.Write(partialFileName, out)) return false;
+  out<<"Partial result written to "<<partialFileName<<std::endl;
+  return true;
+}
+
+
+// Merge the partial results of all input and reference shards, then compare
+// them branch by branch as a single run over all shards would
+void ComparePartials(const std::vector<std::string>& partialFileNames, const ValidationOptions& options, ComparisonSummary& summary, std::string& inputSources, std::string& refSources, std::ostream& out) {
+  void CompareHistogram(std::string branchName, BranchAccumulator *acc, BranchAccumulator *refacc, const Normalisation& norm, const BranchSpec& spec, const ValidationOptions& options, unsigned long streamId, ComparisonSummary& summary, std::ostream& out);
+
+  // One merged partial per role
+  PartialResult *merged[2] = {0, 0};
+  bool read = true;
+  for (size_t f=0; read && f<partialFileNames.size(); ++f) {
+    out<<"Merging "<<partialFileNames[f]<<std::endl;
+    PartialResult *partial = PartialResult::Read(partialFileNames[f], out, options.branchPatterns);
+    read = partial != 0;
+    if (!read) break;
+    int role = partial->GetRole();
+    if (merged[role]) merged[role]->Merge(partial, out);
+    else merged[role] = partial;
+  }
+  if (read && (!merged[PartialResult::kInput] || !merged[PartialResult::kReference])) {
+    out<<"Error: --merge needs partial results of both input and reference shards"<<std::endl;
+    read = false;
+  }
+  if (!read) {
+    delete merged[PartialResult::kInput];
+    delete merged[PartialResult::kReference];
+    return;
+  }
+
+  // The shard files are what the results are recorded under
+  const std::vector<std::string>& sources = merged[PartialResult::kInput]->GetSources();
+  const std::vector<std::string>& refs = merged[PartialResult::kReference]->GetSources();
+  for (size_t s=0; s<sources.size(); ++s) inputSources += (s ? " " : "") + sources[s];
+  for (size_t s=0; s<refs.size(); ++s) refSources += (s ? " " : "") + refs[s];
+
+  const std::vector<PartialTree>& trees = merged[PartialResult::kInput]->GetTrees();
+  const std::vector<PartialTree>& refTrees = merged[PartialResult::kReference]->GetTrees();
+  for (size_t t=0; t<trees.size(); ++t) {
+    const PartialTree& tree = trees[t];
+    size_t r = 0;
+    while (r < refTrees.size() && refTrees[r].name != tree.name) ++r;
+    if (r == refTrees.size()) {
+      out<<"WARNING: no reference data in a tree named "<<tree.name<<" found in the partial results. To generate statistics, merge reference shards of this tree."<<std::endl;
+      continue;
+    }
+    const PartialTree& refTree = refTrees[r];
+    std::string prefix = (trees.size() > 1) ? tree.name+"/" : "";
+
+    out<<""<<std::endl;
+    out<<"Statistics on branches of tree "<<tree.name<<" (merged from "<<sources.size()<<" input and "<<refs.size()<<" reference shards)"<<std::endl;
+    out<<""<<std::endl;
+
+    for (size_t i=0; i<tree.branchNames.size(); ++i) {
+      std::string branchName = prefix+tree.branchNames[i];
+      size_t b = std::find(refTree.branchNames.begin(), refTree.branchNames.end(), tree.branchNames[i]) - refTree.branchNames.begin();
+      if (b == refTree.branchNames.size()) {
+        out<<"WARNING: branch "<<branchName<<" not found in reference file. No comparison statistics will be made for this branch"<<std::endl;
+        continue;
+      }
+      BranchSpec spec = options.spec->Resolve(tree.branchNames[i], tree.name+"/"+tree.branchNames[i]);
+      BranchAccumulator *acc = tree.accumulators[i];
+      acc->Finalise();
+
+      // The reference takes the binning of the merged input, as in a single run
+      BranchAccumulator refacc(AccumulatorRegistry::HistogramName(AccumulatorRegistry::kReference, tree.branchNames[i]), *acc);
+      refacc.Merge(*refTree.accumulators[b], out);
+      refacc.Finalise();
+
+      bool weighted = !spec.weight.empty() || !spec.refWeight.empty();
+      Normalisation norm(tree.entries, refTree.entries, weighted);
+      if (!spec.selection.empty()) {
+        norm = Normalisation((Long64_t) acc->GetEntries(), (Long64_t) refacc.GetEntries(), weighted);
+      }
+      CompareHistogram(branchName, acc, &refacc, norm, spec, options, ResultStore::BranchHash(branchName), summary, out);
+    }
+  }
+  delete merged[PartialResult::kInput];
+  delete merged[PartialResult::kReference];
+}
+
+
+void CompareTree(TTree *tree, TTree *reftree, const std::string& prefix, const ValidationOptions& options, ComparisonSummary& summary, std::ostream& out) {
+  void CompareBranchGroup(TTree *tree, TTree *reftree, const std::vector<std::string>& branchNames, const std::vector<BranchSpec>& specs, const std::string& prefix, const ValidationOptions& options, int pass, int npasses, ComparisonSummary& summary, std::ostream& out);
+  BranchIdentity IdenticalBranch(TTree *tree, TTree *reftree, const std::string& branchName, const BranchSpec& spec, const SchemaDiff& schema, std::map<std::string, BranchIdentity>& weights);
+
+  // Branches of both trees from their headers alone: only those in both are compared
+  SchemaDiff schema = DiffSchemas(tree, reftree);
+  schema.Print(out);
+  if (options.schemaOnly) return;
+  for (size_t i=0; i<schema.inputOnly.size(); ++i) tree->DropBranchFromCache(schema.inputOnly[i].name.c_str(), kTRUE);
+  for (size_t i=0; i<schema.referenceOnly.size(); ++i) reftree->DropBranchFromCache(schema.referenceOnly[i].name.c_str(), kTRUE);
+
+  // The compared branches with their settings from the spec
+  std::vector<std::string> branchNames;
+  std::vector<BranchSpec> specs;
+  std::vector<double> branchBytes;
+  std::vector<std::string> identicalNames;
+  std::map<std::string, BranchIdentity> weightIdentities; // weight branches are compared once
+  for (size_t i=0; i<schema.common.size(); ++i) {
+    std::string branchName = schema.common[i];
+    if (!MatchesBranch(options.branchPatterns, tree->GetName(), branchName)) continue;
+    BranchSpec spec = options.spec->Resolve(branchName, std::string(tree->GetName())+"/"+branchName);
+    // Branches proven identical from their baskets are reported and not filled
+    BranchIdentity identity = options.skipIdentical ? IdenticalBranch(tree, reftree, branchName, spec, schema, weightIdentities) : kNotIdentical;
+    if (identity != kNotIdentical) {
+      out<<"Branch "<<prefix<<branchName<<" identical in both files ("<<BranchIdentityName(identity)<<"), not compared"<<std::endl;
+      summary.AddIdentical(prefix+branchName);
+      identicalNames.push_back(branchName);
+      continue;
+    }
+    branchNames.push_back(branchName);
+    specs.push_back(spec);
+    if (options.memoryBudget > 0) {
+      TBranch *branch = tree->GetBranch(branchName.c_str());
+      branchBytes.push_back(EstimateBranchMemory(branch, reftree->GetBranch(branchName.c_str()), specs.back().nbins));
+    }
+  }
+
+  // Identical branches are not read, unless they weigh or select the compared ones
+  std::set<std::string> conditionNames;
+  for (size_t i=0; i<specs.size(); ++i) {
+    conditionNames.insert(specs[i].selection);
+    conditionNames.insert(specs[i].weight);
+    conditionNames.insert(specs[i].refWeight);
+  }
+  for (size_t i=0; i<identicalNames.size(); ++i) {
+    if (conditionNames.count(identicalNames[i])) continue;
+    tree->DropBranchFromCache(identicalNames[i].c_str(), kTRUE);
+    reftree->DropBranchFromCache(identicalNames[i].c_str(), kTRUE);
+  }
+
+  if (branchNames.empty()) {
+    if (identicalNames.empty()) out<<"WARNING: no branch of tree "<<tree->GetName()<<" to compare"<<std::endl;
+    if (options.progress) options.progress->AddWork(-(tree->GetEntries() + reftree->GetEntries()));
+    return;
+  }
+
+  // All branches in a single pass, unless they do not fit in the memory budget
+  std::vector<std::vector<size_t> > groups(1);
+  for (size_t i=0; i<branchNames.size(); ++i) groups[0].push_back(i);
+  if (options.memoryBudget > 0) {
+    groups = PlanBranchGroups(branchBytes, options.memoryBudget);
+    PrintMemoryPlan(tree->GetName(), groups, branchBytes, options.memoryBudget, out);
+  }
+  if (options.progress) options.progress->AddWork((groups.size()-1)*(tree->GetEntries() + reftree->GetEntries()));
+
+  for (size_t g=0; g<groups.size(); ++g) {
+    std::vector<std::string> groupNames;
+    std::vector<BranchSpec> groupSpecs;
+    for (size_t k=0; k<groups[g].size(); ++k) {
+      groupNames.push_back(branchNames[groups[g][k]]);
+      groupSpecs.push_back(specs[groups[g][k]]);
+    }
+    CompareBranchGroup(tree, reftree, groupNames, groupSpecs, prefix, options, g+1, groups.size(), summary, out);
+  }
+}
+
+
+// Whether a branch fills the same histograms from both files: the branch and
+// its weight branch hold the same values. Branches with a selection, a changed
+// type or a weight expression are always compared.
+BranchIdentity IdenticalBranch(TTree *tree, TTree *reftree, const std::string& branchName, const BranchSpec& spec, const SchemaDiff& schema, std::map<std::string, BranchIdentity>& weights) {
+  if (!spec.selection.empty() || spec.weight != spec.refWeight) return kNotIdentical;
+  for (size_t i=0; i<schema.changed.size(); ++i) {
+    if (schema.changed[i].first.name == branchName || schema.changed[i].first.name == spec.weight) return kNotIdentical;
+  }
+  BranchIdentity identity = CompareBranchBaskets(tree->GetBranch(branchName.c_str()), reftree->GetBranch(branchName.c_str()));
+  if (identity == kNotIdentical || spec.weight.empty()) return identity;
+  std::map<std::string, BranchIdentity>::const_iterator known = weights.find(spec.weight);
+  if (known == weights.end()) {
+    TBranch *weight = tree->GetBranch(spec.weight.c_str());
+    TBranch *refWeight = reftree->GetBranch(spec.weight.c_str());
+    weights[spec.weight] = (weight && refWeight) ? CompareBranchBaskets(weight, refWeight) : kNotIdentical;
+  }
+  BranchIdentity weightIdentity = weights[spec.weight];
+  if (weightIdentity == kNotIdentical) return kNotIdentical;
+  return (weightIdentity == kSameContent) ? kSameContent : identity;
+}
+
+
+// Fill and compare one group of branches, one pass over each tree
+void CompareBranchGroup(TTree *tree, TTree *reftree, const std::vector<std::string>& branchNames, const std::vector<BranchSpec>& specs, const std::string& prefix, const ValidationOptions& options, int pass, int npasses, ComparisonSummary& summary, std::ostream& out) {
+  void CompareHistogram(std::string branchName, BranchAccumulator *acc, BranchAccumulator *refacc, const Normalisation& norm, const BranchSpec& spec, const ValidationOptions& options, unsigned long streamId, ComparisonSummary& summary, std::ostream& out);
+
+  // An interrupted run continues from the checkpoint of this pass
+  PassCheckpoint checkpoint;
+  bool resumed = options.checkpoints && options.resume && options.checkpoints->Load(tree->GetName(), pass, branchNames, checkpoint, out);
+  int phase = resumed ? checkpoint.phase : (int) PassCheckpoint::kInput;
+  Long64_t firstEntry = resumed ? checkpoint.nextEntry : 0;
+  if (resumed) {
+    out<<"Resuming pass "<<pass<<" of tree "<<tree->GetName()<<" from its checkpoint";
+    if (phase != PassCheckpoint::kComplete) out<<" at entry "<<firstEntry<<" of the "<<(phase == PassCheckpoint::kInput ? "input" : "reference")<<" tree";
+    out<<std::endl;
+  }
+
+  // Accumulators of this pass, owned by its registry
+  AccumulatorRegistry registry(branchNames);
+  const std::vector<BranchAccumulator*>& accumulators = registry.Get(AccumulatorRegistry::kInput);
+  const std::vector<BranchAccumulator*>& matched = registry.Get(AccumulatorRegistry::kReference);
+  std::vector<FillCondition> conditions;
+  for (size_t i=0; i<branchNames.size(); ++i) {
+    if (resumed) registry.Adopt(AccumulatorRegistry::kInput, i, checkpoint.accumulators[i]);
+    else registry.Create(AccumulatorRegistry::kInput, i, specs[i].nbins, specs[i].lowLimit, specs[i].highLimit);
+    conditions.push_back(FillCondition(specs[i].selection, specs[i].weight));
+  }
+  PassCheckpointer *checkpointer = 0;
+  if (options.checkpoints) checkpointer = new PassCheckpointer(options.checkpoints, tree->GetName(), pass, branchNames, accumulators, matched, out);
+
+  // Later passes only read their own branches through the caches
+  if (npasses > 1) {
+    tree->DropBranchFromCache("*", kTRUE);
+    reftree->DropBranchFromCache("*", kTRUE);
+    for (size_t i=0; i<branchNames.size(); ++i) {
+      tree->AddBranchToCache(branchNames[i].c_str(), kTRUE);
+      if (reftree->GetBranch(branchNames[i].c_str())) reftree->AddBranchToCache(branchNames[i].c_str(), kTRUE);
+    }
+  }
+
+  // Branches and plain conditions of the group are mapped from the column cache
+  ColumnSet columns, refColumns;
+  if (options.columns) {
+    std::vector<std::string> columnNames(branchNames), refColumnNames(branchNames);
+    for (size_t i=0; i<specs.size(); ++i) {
+      columnNames.push_back(specs[i].selection);
+      columnNames.push_back(specs[i].weight);
+      refColumnNames.push_back(specs[i].selection);
+      refColumnNames.push_back(specs[i].refWeight);
+    }
+    options.columns->Open(tree, columnNames, columns, out);
+    options.columns->Open(reftree, refColumnNames, refColumns, out);
+  }
+
+  // Single pass over the input tree fills every branch of the group
+  std::atomic<Long64_t> *entriesRead = options.progress ? options.progress->GetEntryCounter() : 0;
+  bool filled = true;
+  if (phase == PassCheckpoint::kInput) {
+    if (options.rangeThreads > 1) filled = FillAccumulatorsInRanges(tree, branchNames, accumulators, conditions, options.rangeThreads, options.cacheSize, out, entriesRead, &columns, options.files);
+    else filled = FillAccumulators(tree, branchNames, accumulators, conditions, out, firstEntry, checkpointer, true, -1, entriesRead, &columns);
+    firstEntry = 0;
+  }
+
+  // Reference histograms take the binning of the filled input histograms
+  std::vector<std::string> refBranchNames;
+  std::vector<BranchAccumulator*> refAccumulators;
+  std::vector<FillCondition> refConditions;
+  for (size_t i=0; filled && i<branchNames.size(); ++i) {
+    if (resumed && phase != PassCheckpoint::kInput) registry.Adopt(AccumulatorRegistry::kReference, i, checkpoint.refAccumulators[i]);
+    else registry.CreateMatching(AccumulatorRegistry::kReference, i, *accumulators[i]);
+    if (!matched[i]) continue;
+    refBranchNames.push_back(branchNames[i]);
+    refAccumulators.push_back(matched[i]);
+    refConditions.push_back(FillCondition(specs[i].selection, specs[i].refWeight));
+  }
+
+  // Single pass over the reference tree
+  if (filled && phase != PassCheckpoint::kComplete) {
+    if (checkpointer) checkpointer->phase = PassCheckpoint::kReference;
+    if (options.rangeThreads > 1) filled = FillAccumulatorsInRanges(reftree, refBranchNames, refAccumulators, refConditions, options.rangeThreads, options.cacheSize, out, entriesRead, &refColumns, options.files);
+    else filled = FillAccumulators(reftree, refBranchNames, refAccumulators, refConditions, out, firstEntry, checkpointer, true, -1, entriesRead, &refColumns);
+  }
+  if (filled && checkpointer) options.checkpoints->Save(tree->GetName(), pass, branchNames, PassCheckpoint::kComplete, 0, accumulators, matched, out);
+  delete checkpointer;
+
+  // Baskets of this group are not read again
+  if (npasses > 1) {
+    for (size_t i=0; i<branchNames.size(); ++i) {
+      TBranch *branch = tree->GetBranch(branchNames[i].c_str());
+      if (branch) branch->DropBaskets("all");
+      TBranch *refBranch = reftree->GetBranch(branchNames[i].c_str());
+      if (refBranch) refBranch->DropBaskets("all");
+    }
+  }
+
+  out<<""<<std::endl;
+  out<<"Statistics on branches of tree "<<tree->GetName();
+  if (npasses > 1) out<<" (pass "<<pass<<" of "<<npasses<<")";
+  out<<std::endl;
+  out<<""<<std::endl;
+
+  // Loop through Branches
+  for (size_t i=0; filled && i<branchNames.size(); ++i) {
+    if (!matched[i]) continue;
+    // Sample sizes are the tree entries, or the selected values
+    bool weighted = !specs[i].weight.empty() || !specs[i].refWeight.empty();
+    Normalisation norm(tree, reftree, weighted);
+    if (!specs[i].selection.empty()) {
+      norm = Normalisation((Long64_t) accumulators[i]->GetEntries(), (Long64_t) matched[i]->GetEntries(), weighted);
+    }
+    // Call Function
+    std::string branchName = prefix+branchNames[i];
+    CompareHistogram(branchName, accumulators[i], matched[i], norm, specs[i], options, ResultStore::BranchHash(branchName), summary, out);
+  }
+}
+
+void CompareHistogram(std::string branchName, BranchAccumulator *acc, BranchAccumulator *refacc, const Normalisation& norm, const BranchSpec& spec, const ValidationOptions& options, unsigned long streamId, ComparisonSummary& summary, std::ostream& out) {
+  TH1 *h = acc->GetHistogram();
+  TH1 *href = refacc->GetHistogram();
   
-  // Create Histograms to work with from input file
-  TH1D *h = new TH1D(("plt_"+branchName).c_str(),title.c_str(),nbins,lowLimit,highLimit); // automatic limits
-  if ( h->GetSumw2N() == 0 ) h->Sumw2();
-  tree->Draw((branchName + ">> plt_"+branchName).c_str(),"","goff");
-
-  // Create Histograms to work with from reference file
-  TH1D *href = (TH1D*) h->Clone(); // To work with Histograms of identical size we clone h
-  href->SetName(("ref_"+branchName).c_str());
-  href->Reset();
-  
-  if( href->GetSumw2N() == 0 )href->Sumw2();
-  
-  //Filling
-  reftree->Draw((branchName + ">> ref_"+branchName).c_str(),"","goff"); 
-  
-  // Normalise reference number of events to data
-  double scale = (double)tree->GetEntries()/(double)reftree->GetEntries();
-  href->Scale(scale);
+  // Histograms keep raw counts, the reference is only normalised to data for bin contents
+  double scale = norm.ReferenceScale(*acc, *refacc);
 
   // Calculate Comparison Statistics
-  double ks = h->KolmogorovTest(href); // Kolmogorov Test
-  double chi2test = h->Chi2Test(href,"UW"); // weighted Chi2 Test p-value
+  double ks = norm.KolmogorovTest(h, href); // Kolmogorov Test
+  double chi2test = norm.Chi2Test(h, href); // Chi2 Test p-value, unweighted or weighted
+  double chi2exact = ExactChi2Test(*acc, *refacc); // Chi2 Test over exactly counted integer values
+  if (!std::isnan(chi2exact)) chi2test = chi2exact;
+  double adStatistic; // Anderson-Darling statistic
+  double ad = norm.AndersonDarlingTest(*acc, *refacc, adStatistic); // Anderson-Darling p-value
+  double wasserstein = norm.WassersteinDistance(h, href); // Wasserstein-1 distance
+
+  // Optional bootstrap p-values from the filled histograms
+  ResampledPValues resampled;
+  resampled.nResamples = 0;
+  if (options.resampling.nResamples > 0) resampled = ResampleTest(h, href, options.resampling, streamId);
   
-  // Input File Data
-  double std = h->GetStdDev(); // Standard Deviation
-  double std_error = h->GetStdDevError(); // Error on Standard Deviation
-  double skew = h->GetSkewness(); // Skewness
-  double mean = h->GetMean(); // Mean
-  double mean_error = h->GetMeanError(); // Error on Mean
+  // Input File Data, exact weighted moments
+  double std = acc->GetStdDev(); // Standard Deviation
+  double std_error = acc->GetStdDevError(); // Error on Standard Deviation
+  double skew = acc->GetSkewness(); // Skewness
+  double mean = acc->GetMean(); // Mean
+  double mean_error = acc->GetMeanError(); // Error on Mean
   double max = h->GetMaximum(); // Maximum
   double min = h->GetMinimum (); // Minimum  
+  double neff = acc->GetEffectiveEntries(); // Effective Entries
   
-  // Reference File Data
-  double std_ref = href->GetStdDev(); // Standard Deviation
-  double std_error_ref = href->GetStdDevError(); // Error on Standard Deviation
-  double skew_ref = href->GetSkewness(); // Skewness
-  double mean_ref = href->GetMean(); // Mean
-  double mean_error_ref = href->GetMeanError(); // Error on Mean
-  double max_ref = href->GetMaximum(); // Maxmimum
-  double min_ref = href->GetMinimum (); // Minimum
-  
-  std::cout<<"Comparing branches: "<<branchName<<std::endl;
-  std::cout<<""<<std::endl;
-  std::cout<<"Mean: "<<mean<<" ; Reference Mean:"<<mean_ref<<std::endl;
-  std::cout<<"Mean Error: "<<mean_error<<" ; Reference Mean Error:"<<mean_error_ref<<std::endl;
-  std::cout<<"Maximum: "<<max<<" ; Reference Maximum:"<<max_ref<<std::endl;
-  std::cout<<"Minimum: "<<min<<" ; Reference Minimum:"<<min_ref<<std::endl;
-  std::cout<<"Skewness: "<<skew<<" ; Reference Skewness:"<<skew_ref<<std::endl;
-  std::cout<<"Std: "<<std<<" ; Reference Std:"<<std_ref<<std::endl;
-  std::cout<<"Std Error: "<<std_error<<" ; Reference Std Error:"<<std_error_ref<<std::endl;
-  std::cout<<"Kolmogorov: "<<ks<<std::endl;
-  std::cout<<"Chi2 test: "<<chi2test<<std::endl;
-  std::cout<<""<<std::endl;
+  // Reference File Data, exact weighted moments
+  double std_ref = refacc->GetStdDev(); // Standard Deviation
+  double std_error_ref = refacc->GetStdDevError(); // Error on Standard Deviation
+  double skew_ref = refacc->GetSkewness(); // Skewness
+  double mean_ref = refacc->GetMean(); // Mean
+  double mean_error_ref = refacc->GetMeanError(); // Error on Mean
+  double max_ref = href->GetMaximum()*scale; // Maxmimum
+  double min_ref = href->GetMinimum ()*scale; // Minimum
+  double neff_ref = refacc->GetEffectiveEntries(); // Effective Entries
   
-  std::cout<<"Testing branches: "<<branchName<<std::endl;
-  
-  // Running Tests on Comparisons
-  // Both means should lie within 1 std from the other mean (h compared to href and vice versa)
-  bool pass = true;
-  if (mean>(mean_ref+std_ref) || mean<(mean_ref-std_ref)) {
-    std::cout<<"Error: Mean outside of 1 Standard Deviation"<<std::endl;
-    pass = false;
+  out<<"Comparing branches: "<<branchName<<std::endl;
+  out<<""<<std::endl;
+  out<<"Mean: "<<mean<<" ; Reference Mean:"<<mean_ref<<std::endl;
+  out<<"Mean Error: "<<mean_error<<" ; Reference Mean Error:"<<mean_error_ref<<std::endl;
+  out<<"Maximum: "<<max<<" ; Reference Maximum:"<<max_ref<<std::endl;
+  out<<"Minimum: "<<min<<" ; Reference Minimum:"<<min_ref<<std::endl;
+  out<<"Skewness: "<<skew<<" ; Reference Skewness:"<<skew_ref<<std::endl;
+  out<<"Std: "<<std<<" ; Reference Std:"<<std_ref<<std::endl;
+  out<<"Std Error: "<<std_error<<" ; Reference Std Error:"<<std_error_ref<<std::endl;
+  out<<"Kolmogorov: "<<ks<<std::endl;
+  out<<"Chi2 test: "<<chi2test<<std::endl;
+  out<<"Anderson-Darling: "<<ad<<" ; Statistic: "<<adStatistic<<std::endl;
+  out<<"Wasserstein Distance: "<<wasserstein<<std::endl;
+  if (resampled.nResamples > 0) {
+    out<<"Kolmogorov (bootstrap): "<<resampled.ks<<" ; Chi2 test (bootstrap): "<<resampled.chi2<<" ; Resamples: "<<resampled.nResamples<<std::endl;
   }
+  if (norm.weighted) out<<"Effective Entries: "<<neff<<" ; Reference Effective Entries:"<<neff_ref<<std::endl;
+  out<<""<<std::endl;
   
-  // Arbitrary account of the difference in std error
-  if((std_error/std_error_ref)>1.01|| (std_error_ref/std_error)>1.01 || (std_error_ref/std_error)<0.99 || (std_error/std_error_ref)<0.99) {
-    std::cout<<"Error: Standard Deviation Error to large"<<std::endl;
-    pass = false;
+  // Statistics the tests of the spec are run on
+  BranchResult result;
+  result.branch = branchName;
+  result.mean = mean; result.meanError = mean_error; result.std = std; result.stdError = std_error;
+  result.skewness = skew; result.neff = neff; result.max = max; result.min = min;
+  result.refMean = mean_ref; result.refMeanError = mean_error_ref; result.refStd = std_ref; result.refStdError = std_error_ref;
+  result.refSkewness = skew_ref; result.refNeff = neff_ref; result.refMax = max_ref; result.refMin = min_ref;
+  result.ks = ks;
+  result.chi2 = chi2test;
+  result.ad = ad;
+  result.adStatistic = adStatistic;
+  result.wasserstein = wasserstein;
+  if (resampled.nResamples > 0) {
+    result.ks = resampled.ks;
+    result.chi2 = resampled.chi2;
   }
+
+  out<<"Testing branches: "<<branchName<<std::endl;
   
-  // Mean values and Errors on Mean Values
-  if(mean>(mean_ref+mean_error_ref) || mean<(mean_ref-mean_error_ref) || mean_ref>(mean+mean_error) || mean_ref<(mean-mean_error)) {
-    std::cout<<"Error: Mean Value outside error bounds"<<std::endl;
-    pass = false;
-  }
-    
-  // Simple Tests on Max and Min
-  if(max<min_ref || max_ref<min) {
-    std::cout<<"Error: Max, Min reversed"<<std::endl;
-    pass = false;
+  // Running Tests on Comparisons
+  bool pass = true;
+  for (size_t t=0; t<spec.tests.size(); ++t) {
+    const ComparisonTest *test = spec.tests[t];
+    if (test->verdict && !test->verdict(result, spec.thresholds, out)) pass = false;
   }
   
   if (pass) {
-    std::cout<<"All Tests Passed"<<std::endl;
+    out<<"All Tests Passed"<<std::endl;
   }
+  if (options.writer) options.writer->Add(branchName, h, href, scale, pass);
+
+  // p-values are only judged globally, after the multiple-comparison correction
+  result.pass = pass;
+  for (size_t t=0; t<spec.tests.size(); ++t) {
+    const ComparisonTest *test = spec.tests[t];
+    if (!test->pvalue) continue;
+    std::string testName = test->summaryName;
+    if (resampled.nResamples > 0 && std::string(test->name) != "ad") testName += " (bootstrap)";
+    summary.Add(branchName, testName, test->pvalue(result));
+  }
+  summary.AddResult(result);
+  if (options.progress) options.progress->AddResult(branchName, std::fmin(result.ks, result.chi2));
     
-  std::cout<<"---- "<<"Finished working with branches: "<<branchName<<" ----"<<std::endl;
-  std::cout<<""<<std::endl;
-  
-  delete href;
-  delete h;
+  out<<"---- "<<"Finished working with branches: "<<branchName<<" ----"<<std::endl;
+  out<<""<<std::endl;
 }
 
 
@@ -0,0 +1,141 @@
+// Startup benchmark of a small validation: time taken by ROOT initialisation,
+// opening the files and filling a weighted tree through the compiled reading
+// path and through TTreeFormula, and optionally by whole runs of the tool, as
+// a quick check in continuous integration would start it.
+
+// Standard Library
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+
+#include "BranchAccumulator.h"
+#include "EventLoop.h"
+
+// ROOT includes
+#include "TFile.h"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+
+namespace {
+  double Milliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void Report(const std::string& name, double milliseconds) {
+    std::cout<<"  "<<name<<": "<<milliseconds<<" ms"<<std::endl;
+  }
+
+  // Small SimValidation tree: a double, an integer and an event weight
+  bool WriteTree(const std::string& fileName, Long64_t nentries, double shift, unsigned long seed) {
+    TFile file(fileName.c_str(), "RECREATE");
+    if (file.IsZombie()) {
+      std::cout<<"Error: file "<<fileName<<" cannot be written"<<std::endl;
+      return false;
+    }
+    Double_t energy;
+    Int_t hits;
+    Float_t weight;
+    TTree *tree = new TTree("SimValidation", "startup benchmark");
+    tree->Branch("energy", &energy, "energy/D");
+    tree->Branch("hits", &hits, "hits/I");
+    tree->Branch("weight", &weight, "weight/F");
+    std::mt19937_64 generator(seed);
+    std::normal_distribution<double> normal(shift, 1.0);
+    std::poisson_distribution<int> poisson(5.0);
+    std::uniform_real_distribution<float> uniform(0.5, 1.5);
+    for (Long64_t i=0; i<nentries; ++i) {
+      energy = normal(generator);
+      hits = poisson(generator);
+      weight = uniform(generator);
+      tree->Fill();
+    }
+    tree->Write();
+    file.Close();
+    return true;
+  }
+
+  // One weighted pass over all branches of the tree, in milliseconds
+  double FillTree(TTree *tree, const std::string& weight) {
+    std::vector<std::string> branchNames;
+    branchNames.push_back("energy");
+    branchNames.push_back("hits");
+    std::vector<BranchAccumulator*> accumulators;
+    std::vector<FillCondition> conditions;
+    for (size_t i=0; i<branchNames.size(); ++i) {
+      accumulators.push_back(new BranchAccumulator("plt_"+branchNames[i], 100, 0, -9999));
+      conditions.push_back(FillCondition("", weight));
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    FillAccumulators(tree, branchNames, accumulators, conditions, std::cout);
+    double milliseconds = Milliseconds(start);
+    for (size_t i=0; i<accumulators.size(); ++i) delete accumulators[i];
+    return milliseconds;
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  Long64_t nentries = (argc > 1) ? std::atoll(argv[1]) : 1000;
+  std::string tool = (argc > 2) ? argv[2] : "";
+  int runs = (argc > 3) ? std::atoi(argv[3]) : 5;
+  if (nentries <= 0 || runs <= 0) {
+    std::cout<<"Usage: StartupBenchmark [number of entries] [SimulationValidationTool executable] [runs]"<<std::endl;
+    return 1;
+  }
+
+  std::cout<<"Startup of a validation of "<<nentries<<" entries"<<std::endl;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::string version = gROOT->GetVersion();
+  Report("ROOT "+version+" initialisation", Milliseconds(start));
+
+  std::string directory = gSystem->TempDirectory();
+  std::string inputFileName = directory + "/StartupBenchmark_input.root";
+  std::string refFileName = directory + "/StartupBenchmark_reference.root";
+  start = std::chrono::steady_clock::now();
+  if (!WriteTree(inputFileName, nentries, 0.0, 4357) || !WriteTree(refFileName, nentries, 0.1, 4358)) return 1;
+  Report("writing the input and reference files", Milliseconds(start));
+
+  start = std::chrono::steady_clock::now();
+  TFile *inputFile = new TFile(inputFileName.c_str());
+  TTree *tree = (TTree*) inputFile->Get("SimValidation");
+  Report("opening the input file and tree", Milliseconds(start));
+
+  // The first pass reads the baskets, the following ones time the weight: a
+  // branch name once, and an expression TTreeFormula has to compile once
+  Report("first unweighted pass", FillTree(tree, ""));
+  Report("filling, compiled reading path", FillTree(tree, "weight"));
+  Report("filling, TTreeFormula weight", FillTree(tree, "1*weight"));
+  delete tree;
+  inputFile->Close();
+  delete inputFile;
+
+  // Complete runs of the tool, each paying for its own startup
+  int status = 0;
+  if (!tool.empty()) {
+    std::string command = tool + " -i " + inputFileName + " -r " + refFileName + " -w weight > /dev/null";
+    std::vector<double> times;
+    for (int r=0; r<runs && status==0; ++r) {
+      start = std::chrono::steady_clock::now();
+      int code = std::system(command.c_str());
+      times.push_back(Milliseconds(start));
+      if (code == -1 || !WIFEXITED(code)) status = 1;
+    }
+    if (status != 0) std::cout<<"Error: "<<command<<" failed"<<std::endl;
+    else {
+      std::sort(times.begin(), times.end());
+      Report("fastest run of the tool", times.front());
+      Report("median run of the tool", times[times.size()/2]);
+    }
+  }
+
+  gSystem->Unlink(inputFileName.c_str());
+  gSystem->Unlink(refFileName.c_str());
+  return status;
+}
@@ -0,0 +1,307 @@
+// Standard Library
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ValidationDaemon.h"
+#include "BinaryIO.h"
+#include "FilePool.h"
+
+
+namespace {
+  const char *kMagic = "SVTDAEMON1";
+  enum RequestKind { kRun = 0, kStop = 1 };
+
+  // Doubles of a result as sent, in declaration order
+  double BranchResult::* const kResultValues[] = {
+    &BranchResult::mean, &BranchResult::meanError, &BranchResult::std, &BranchResult::stdError,
+    &BranchResult::skewness, &BranchResult::neff, &BranchResult::max, &BranchResult::min,
+    &BranchResult::refMean, &BranchResult::refMeanError, &BranchResult::refStd, &BranchResult::refStdError,
+    &BranchResult::refSkewness, &BranchResult::refNeff, &BranchResult::refMax, &BranchResult::refMin,
+    &BranchResult::ks, &BranchResult::chi2, &BranchResult::ad, &BranchResult::adStatistic, &BranchResult::wasserstein
+  };
+  const size_t kNResultValues = sizeof(kResultValues)/sizeof(kResultValues[0]);
+
+  bool WriteAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+      ssize_t n = send(fd, data, size, MSG_NOSIGNAL); // a client gone does not raise SIGPIPE
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool ReadAll(int fd, char *data, size_t size) {
+    while (size > 0) {
+      ssize_t n = recv(fd, data, size, 0);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool SendMessage(int fd, const std::string& payload) {
+    unsigned long long size = payload.size();
+    return WriteAll(fd, (const char*) &size, sizeof(size)) && WriteAll(fd, payload.data(), payload.size());
+  }
+
+  bool ReceiveMessage(int fd, std::string& payload) {
+    unsigned long long size = 0;
+    if (!ReadAll(fd, (char*) &size, sizeof(size)) || size > (1ULL << 32)) return false;
+    payload.resize(size);
+    return size == 0 || ReadAll(fd, &payload[0], size);
+  }
+
+  std::string EncodeRequest(int kind, const std::vector<std::string>& args) {
+    std::ostringstream out;
+    WriteBinary(out, std::string(kMagic));
+    WriteBinary(out, kind);
+    unsigned long long nargs = args.size();
+    WriteBinary(out, nargs);
+    for (size_t i=0; i<args.size(); ++i) WriteBinary(out, args[i]);
+    return out.str();
+  }
+
+  bool DecodeRequest(const std::string& payload, int& kind, std::vector<std::string>& args) {
+    std::istringstream in(payload);
+    std::string magic;
+    unsigned long long nargs = 0;
+    if (!ReadBinary(in, magic) || magic != kMagic || !ReadBinary(in, kind) || !ReadBinary(in, nargs)) return false;
+    args.resize(nargs < 4096 ? nargs : 0);
+    for (size_t i=0; i<args.size(); ++i) {
+      if (!ReadBinary(in, args[i])) return false;
+    }
+    return args.size() == nargs;
+  }
+
+  std::string EncodeReply(int status, const std::string& output, const std::vector<BranchResult>& results) {
+    std::ostringstream out;
+    WriteBinary(out, std::string(kMagic));
+    WriteBinary(out, status);
+    WriteBinary(out, std::vector<char>(output.begin(), output.end()));
+    unsigned long long nresults = results.size();
+    WriteBinary(out, nresults);
+    for (size_t i=0; i<results.size(); ++i) {
+      WriteBinary(out, results[i].branch);
+      for (size_t v=0; v<kNResultValues; ++v) WriteBinary(out, results[i].*kResultValues[v]);
+      WriteBinary(out, (char) results[i].pass);
+    }
+    return out.str();
+  }
+
+  bool DecodeReply(const std::string& payload, DaemonReply& reply) {
+    std::istringstream in(payload);
+    std::string magic;
+    std::vector<char> output;
+    unsigned long long nresults = 0;
+    if (!ReadBinary(in, magic) || magic != kMagic || !ReadBinary(in, reply.status) || !ReadBinary(in, output) ||
+        !ReadBinary(in, nresults)) return false;
+    reply.output.assign(output.begin(), output.end());
+    reply.results.clear();
+    for (unsigned long long i=0; i<nresults; ++i) {
+      BranchResult result = BranchResult();
+      char pass = 0;
+      if (!ReadBinary(in, result.branch)) return false;
+      for (size_t v=0; v<kNResultValues; ++v) {
+        if (!ReadBinary(in, result.*kResultValues[v])) return false;
+      }
+      if (!ReadBinary(in, pass)) return false;
+      result.pass = pass;
+      reply.results.push_back(result);
+    }
+    return true;
+  }
+
+  bool SocketAddress(const std::string& socketPath, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) return false;
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    return true;
+  }
+
+  std::string JoinArguments(const std::vector<std::string>& args) {
+    std::string joined;
+    for (size_t i=0; i<args.size(); ++i) joined += (i > 0 ? " " : "") + args[i];
+    return joined;
+  }
+}
+
+
+ValidationDaemon::ValidationDaemon(const std::string& path, int threads, ToolRun runTool)
+  : socketPath(path), nthreads(threads > 0 ? threads : 1), run(runTool), files(new FilePool(nthreads)),
+    listener(-1), stopping(false), log(0), nrequests(0) {
+}
+
+
+ValidationDaemon::~ValidationDaemon() {
+  if (listener >= 0) close(listener);
+  delete files;
+}
+
+
+bool ValidationDaemon::Serve(std::ostream& logStream) {
+  log = &logStream;
+  sockaddr_un address;
+  if (!SocketAddress(socketPath, address)) {
+    *log<<"Error: socket path "<<socketPath<<" is empty or too long"<<std::endl;
+    return false;
+  }
+
+  // A socket left behind by a daemon that did not stop is replaced, never another file
+  int other = ConnectToDaemon(socketPath);
+  if (other >= 0) {
+    close(other);
+    *log<<"Error: a daemon already listens on "<<socketPath<<std::endl;
+    return false;
+  }
+  struct stat status;
+  if (lstat(socketPath.c_str(), &status) == 0) {
+    if (!S_ISSOCK(status.st_mode)) {
+      *log<<"Error: "<<socketPath<<" exists and is not a socket"<<std::endl;
+      return false;
+    }
+    unlink(socketPath.c_str());
+  }
+
+  // Runs read and write files as this user: the socket is private from its
+  // creation on, no other user can connect before listen
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t mask = umask(0077);
+  bool bound = listener >= 0 && bind(listener, (sockaddr*) &address, sizeof(address)) == 0;
+  umask(mask);
+  if (!bound || chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listener, 64) != 0) {
+    *log<<"Error: cannot listen on "<<socketPath<<": "<<std::strerror(errno)<<std::endl;
+    if (listener >= 0) close(listener);
+    listener = -1;
+    if (bound) unlink(socketPath.c_str());
+    return false;
+  }
+  *log<<"Listening on "<<socketPath<<" with "<<nthreads<<" worker threads"<<std::endl;
+
+  std::vector<std::thread> workers;
+  for (int w=0; w<nthreads; ++w) workers.push_back(std::thread(&ValidationDaemon::Work, this));
+
+  // Accepts until a stop request shuts the listening socket down
+  while (true) {
+    int connection = accept(listener, 0, 0);
+    if (connection < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping) {
+      close(connection);
+      break;
+    }
+    connections.push_back(connection);
+    pending.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  pending.notify_all();
+  for (size_t w=0; w<workers.size(); ++w) workers[w].join();
+  close(listener);
+  listener = -1;
+  unlink(socketPath.c_str());
+  *log<<"Daemon stopped after "<<nrequests<<" requests"<<std::endl;
+  return true;
+}
+
+
+void ValidationDaemon::Work() {
+  while (true) {
+    int connection;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (connections.empty() && !stopping) pending.wait(lock);
+      if (connections.empty()) return; // stopping, nothing queued
+      connection = connections.front();
+      connections.pop_front();
+    }
+    Handle(connection);
+  }
+}
+
+
+void ValidationDaemon::Handle(int connection) {
+  std::string payload;
+  int kind = kRun;
+  std::vector<std::string> args;
+  if (!ReceiveMessage(connection, payload) || !DecodeRequest(payload, kind, args)) {
+    close(connection);
+    return;
+  }
+
+  if (kind == kStop) {
+    SendMessage(connection, EncodeReply(1, "Daemon on " + socketPath + " stopping\n", std::vector<BranchResult>()));
+    close(connection);
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    shutdown(listener, SHUT_RDWR); // wakes up accept
+    return;
+  }
+
+  unsigned long id = ++nrequests;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::ostringstream out;
+  std::vector<BranchResult> results;
+  int exitStatus = 0;
+  try {
+    exitStatus = run(args, out, files, results);
+  }
+  catch (std::exception& e) {
+    out<<"Error: "<<e.what()<<std::endl;
+  }
+  bool replied = SendMessage(connection, EncodeReply(exitStatus, out.str(), results));
+  close(connection);
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::lock_guard<std::mutex> lock(logMutex);
+  *log<<"Request "<<id<<": "<<JoinArguments(args)<<" -> status "<<exitStatus<<", "<<results.size()<<" branches in "
+      <<seconds<<" s ; "<<files->GetReused()<<" of "<<files->GetOpened()<<" file opens reused"
+      <<(replied ? "" : " ; client gone before the reply")<<std::endl;
+}
+
+
+int ConnectToDaemon(const std::string& socketPath) {
+  sockaddr_un address;
+  if (!SocketAddress(socketPath, address)) return -1;
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) return -1;
+  if (connect(connection, (sockaddr*) &address, sizeof(address)) != 0) {
+    close(connection);
+    return -1;
+  }
+  return connection;
+}
+
+
+bool RunInDaemon(int connection, const std::vector<std::string>& args, DaemonReply& reply) {
+  std::string payload;
+  bool ok = SendMessage(connection, EncodeRequest(kRun, args)) && ReceiveMessage(connection, payload) && DecodeReply(payload, reply);
+  close(connection);
+  return ok;
+}
+
+
+bool StopDaemon(int connection) {
+  std::string payload;
+  DaemonReply reply;
+  bool ok = SendMessage(connection, EncodeRequest(kStop, std::vector<std::string>())) && ReceiveMessage(connection, payload) && DecodeReply(payload, reply);
+  close(connection);
+  return ok;
+}
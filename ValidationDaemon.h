@@ -0,0 +1,85 @@
+#ifndef VALIDATIONDAEMON_H
+#define VALIDATIONDAEMON_H
+
+// Standard Library
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ComparisonSummary.h"
+
+class FilePool;
+
+
+// One run of the tool: its command line arguments without the program name,
+// output written to out and the results of the compared branches; returns
+// the exit status the tool would have
+typedef int (*ToolRun)(const std::vector<std::string>& args, std::ostream& out, FilePool *files, std::vector<BranchResult>& results);
+
+
+// Reply of a daemon to one run
+struct DaemonReply {
+  int status;
+  std::string output;
+  std::vector<BranchResult> results;
+};
+
+
+// Long-lived server on a local Unix socket, so that many small comparisons
+// pay for process and ROOT startup once and find their files already open in
+// a pool. Requests are run concurrently by a fixed number of worker threads,
+// each with its own output, and a stop request finishes the queued ones.
+//
+// Every message is a 64-bit length followed by a BinaryIO payload. A request
+// holds the magic "SVTDAEMON1", its kind (0 run, 1 stop), the number of
+// arguments and the arguments; a reply the magic, the exit status, the output
+// text and the number of results, each a branch name, the doubles of
+// BranchResult in declaration order and the verdict.
+class ValidationDaemon {
+public:
+  ValidationDaemon(const std::string& socketPath, int nthreads, ToolRun run);
+  ~ValidationDaemon();
+
+  // Listens until a stop request; false if the socket cannot be bound or
+  // another daemon listens on it already. One line per request goes to log.
+  bool Serve(std::ostream& log);
+
+private:
+  ValidationDaemon(const ValidationDaemon&);
+  ValidationDaemon& operator=(const ValidationDaemon&);
+
+  void Work();
+  void Handle(int connection);
+
+  std::string socketPath;
+  int nthreads;
+  ToolRun run;
+  FilePool *files;
+  int listener;
+
+  std::mutex mutex;
+  std::condition_variable pending;
+  std::deque<int> connections;
+  bool stopping;
+
+  std::mutex logMutex;
+  std::ostream *log;
+  std::atomic<unsigned long> nrequests;
+};
+
+
+// Client side: connection to the daemon on socketPath, -1 if none listens
+int ConnectToDaemon(const std::string& socketPath);
+
+// Runs the arguments in the daemon and closes the connection; false if the
+// daemon went away before replying
+bool RunInDaemon(int connection, const std::vector<std::string>& args, DaemonReply& reply);
+
+// Asks the daemon to finish the queued requests and exit
+bool StopDaemon(int connection);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef VECTORKERNELS_H
+#define VECTORKERNELS_H
+
+// Standard Library
+#include <cstddef>
+
+
+// Weighted sums over a block of values, taken about a shift value so that
+// the block can be merged into running central moments without cancellation
+struct BlockMoments {
+  double sumw;
+  double sumw2;
+  double s1; // sum w (x-shift)
+  double s2; // sum w (x-shift)^2
+  double s3; // sum w (x-shift)^3
+  double min;
+  double max;
+};
+
+
+// Hot loops of the accumulators over contiguous blocks of (value, weight).
+// AVX versions are selected at run time when the CPU supports them, the
+// scalar versions are used otherwise and give the same bins; sums may differ
+// in the last bits through the summation order.
+void BlockMomentsKernel(const double *x, const double *w, size_t n, double shift, BlockMoments& m);
+
+// Fill contents[bin] += w and sumw2[bin] += w*w for fixed regular binning,
+// with the TAxis::FindFixBin convention (0 underflow, nbins+1 overflow and NaN)
+void BlockHistogramKernel(const double *x, const double *w, size_t n, int nbins, double xmin, double xmax,
+                          double *contents, double *sumw2);
+
+// Area between two cumulative distributions: sum of |ca[i]/na - cb[i]/nb| widths[i]
+// over cumulative counts ca, cb up to and including each bin
+double CdfDistanceKernel(const double *ca, const double *cb, const double *widths, size_t n, double na, double nb);
+
+// Two-sample Anderson-Darling statistic of Scholz and Stephens for tied values,
+// one distinct value per bin: counts a, b and cumulative counts ca, cb up to
+// and including each bin, sample sizes na, nb
+double AndersonDarlingKernel(const double *a, const double *b, const double *ca, const double *cb, size_t n,
+                             double na, double nb);
+
+// Select the scalar kernels (false) or the best available ones (true);
+// returns whether vectorised kernels are now in use
+bool UseVectorKernels(bool enable);
+const char* VectorKernelsName();
+
+#endif